@@ -0,0 +1,56 @@
+// Helpers shared by the benchmarks, inline so that each one can use a subset.
+//
+// Timing, sorting samples and building the plugins that the benchmarks
+// generate.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef BENCH_ROOT
+#define BENCH_ROOT "."
+#endif
+
+static inline uint64_t
+bench_now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static inline int
+bench_compare_u64(const void* lhs, const void* rhs) {
+	uint64_t a = *(const uint64_t*)lhs;
+	uint64_t b = *(const uint64_t*)rhs;
+	return (a > b) - (a < b);
+}
+
+// Where generated files are written, from TMPDIR
+static inline const char*
+bench_work_dir(void) {
+	return getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+}
+
+// The compiler for generated plugins, from CC
+static inline const char*
+bench_cc(void) {
+	return getenv("CC") != NULL ? getenv("CC") : "cc";
+}
+
+static inline bool
+bench_compile(const char* cc, const char* opt_flags, const char* source_path, const char* lib_path) {
+	char command[4096];
+	snprintf(
+		command, sizeof(command),
+		"%s %s -std=c11 -fPIC -shared -fvisibility=hidden -I '%s' -o '%s' '%s'",
+		cc, opt_flags, BENCH_ROOT, lib_path, source_path
+	);
+	return system(command) == 0;
+}
+
+#endif
@@ -0,0 +1,173 @@
+// Per-call overhead benchmark.
+//
+// Compares calling a function exported with REMODULE_EXPORT_FN through the
+// entry point from remodule_function against a direct call and a cached
+// function pointer.
+// Also measures the cost of tracking those calls with a read section or
+// with REMODULE_ENTER/REMODULE_EXIT, and of a remodule_drain, see usage().
+
+#define REMODULE_HOST_IMPLEMENTATION
+#include "../remodule.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+typedef int (*bench_fn_t)(int arg);
+
+typedef struct bench_options_s {
+	long long iterations;
+	const char* work_dir;
+	const char* cc;
+} bench_options_t;
+
+__attribute__((noinline)) static int
+bench_local_call(int arg) {
+	__asm__ volatile("");
+	return arg + 1;
+}
+
+static bool
+bench_generate(const char* source_path) {
+	FILE* file = fopen(source_path, "w");
+	if (file == NULL) { return false; }
+
+	fprintf(file,
+		"#define REMODULE_PLUGIN_IMPLEMENTATION\n"
+		"#include \"remodule.h\"\n"
+		"\n"
+		"static int\n"
+		"bench_call(int arg) {\n"
+		"\treturn arg + 1;\n"
+		"}\n"
+		"REMODULE_EXPORT_FN(bench_call)\n"
+		"\n"
+		"void\n"
+		"remodule_entry(remodule_op_t op, void* userdata) {\n"
+		"\t(void)op;\n"
+		"\t(void)userdata;\n"
+		"}\n"
+	);
+
+	return fclose(file) == 0;
+}
+
+static void
+bench_report(const char* op, uint64_t duration_ns, long long iterations, int sum) {
+	// Printing the sum keeps the loops from being optimized away
+	printf("%-17s %10.3f %16d\n", op, (double)duration_ns / (double)iterations, sum);
+}
+
+static void
+usage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"\n"
+		"Options:\n"
+		"  --iterations=N   Number of calls per method (default: 200000000)\n"
+		"\n"
+		"Environment:\n"
+		"  CC               Compiler for the generated plugin (default: cc)\n"
+		"  TMPDIR           Where the generated plugin is written (default: /tmp)\n",
+		program
+	);
+}
+
+int
+main(int argc, const char* argv[]) {
+	bench_options_t options = {
+		.iterations = 200000000,
+		.cc = bench_cc(),
+		.work_dir = bench_work_dir(),
+	};
+
+	for (int i = 1; i < argc; ++i) {
+		unsigned long long value;
+		if (sscanf(argv[i], "--iterations=%llu", &value) == 1 && value > 0) {
+			options.iterations = (long long)value;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	char source_path[1024];
+	char lib_path[1024];
+	snprintf(source_path, sizeof(source_path), "%s/call.c", options.work_dir);
+	snprintf(lib_path, sizeof(lib_path), "%s/call.so", options.work_dir);
+	if (!bench_generate(source_path) || !bench_compile(options.cc, "-O2", source_path, lib_path)) {
+		fprintf(stderr, "Could not build plugin\n");
+		return 1;
+	}
+
+	remodule_t* mod = remodule_load(lib_path, NULL);
+	remodule_fn_t volatile const* entry = remodule_function(mod, "bench_call");
+	if (*entry == NULL) {
+		fprintf(stderr, "Plugin does not export bench_call\n");
+		return 1;
+	}
+	// What a host that re-registers after every reload would hold
+	bench_fn_t volatile cached_fn = (bench_fn_t)*entry;
+	remodule_reader_t* reader = remodule_register_reader(mod);
+	remodule_call_counter_t* counter = remodule_register_call_counter(mod);
+	long long iterations = options.iterations;
+
+	printf("%-17s %10s %16s\n", "method", "ns/call", "checksum");
+
+	int sum = 0;
+	uint64_t start_ns = bench_now_ns();
+	for (long long i = 0; i < iterations; ++i) {
+		sum += bench_local_call((int)i);
+	}
+	bench_report("direct", bench_now_ns() - start_ns, iterations, sum);
+
+	sum = 0;
+	bench_fn_t fn = cached_fn;
+	start_ns = bench_now_ns();
+	for (long long i = 0; i < iterations; ++i) {
+		sum += fn((int)i);
+	}
+	bench_report("cached_pointer", bench_now_ns() - start_ns, iterations, sum);
+
+	sum = 0;
+	start_ns = bench_now_ns();
+	for (long long i = 0; i < iterations; ++i) {
+		sum += REMODULE_CALL(entry, bench_fn_t)((int)i);
+	}
+	bench_report("entry_point", bench_now_ns() - start_ns, iterations, sum);
+
+	sum = 0;
+	start_ns = bench_now_ns();
+	for (long long i = 0; i < iterations; ++i) {
+		remodule_read_lock(reader);
+		sum += REMODULE_CALL(entry, bench_fn_t)((int)i);
+		remodule_read_unlock(reader);
+	}
+	bench_report("entry_point+lock", bench_now_ns() - start_ns, iterations, sum);
+
+	sum = 0;
+	start_ns = bench_now_ns();
+	for (long long i = 0; i < iterations; ++i) {
+		REMODULE_ENTER(counter);
+		sum += REMODULE_CALL(entry, bench_fn_t)((int)i);
+		REMODULE_EXIT(counter);
+	}
+	bench_report("entry_point+enter", bench_now_ns() - start_ns, iterations, sum);
+
+	// Far slower than a call, run fewer
+	long long num_drains = iterations / 100000 > 0 ? iterations / 100000 : 1;
+	start_ns = bench_now_ns();
+	for (long long i = 0; i < num_drains; ++i) {
+		remodule_drain(mod, -1);
+	}
+	bench_report("drain", bench_now_ns() - start_ns, num_drains, 0);
+
+	remodule_unload(mod);
+	unlink(source_path);
+	unlink(lib_path);
+	return 0;
+}
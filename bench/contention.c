@@ -0,0 +1,270 @@
+// Read-side contention benchmark.
+//
+// Worker threads call a function published by a plugin as fast as they can
+// while the main thread reloads it.
+// Reports the cost per call of a direct call, of a call inside
+// remodule_read_lock/remodule_read_unlock and of the same with reloads going
+// on, see usage().
+
+#define REMODULE_HOST_IMPLEMENTATION
+#include "../remodule.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+typedef struct bench_interface_s {
+	int (*call)(int arg);
+} bench_interface_t;
+
+typedef enum bench_mode_e {
+	BENCH_MODE_DIRECT,
+	BENCH_MODE_LOCKED,
+	BENCH_MODE_LOCKED_RELOADING,
+} bench_mode_t;
+
+typedef struct bench_options_s {
+	int num_threads;
+	int duration_ms;
+	int reload_interval_ms;
+	const char* work_dir;
+	const char* cc;
+} bench_options_t;
+
+typedef struct bench_worker_s {
+	pthread_t thread;
+	remodule_t* mod;
+	bench_mode_t mode;
+	atomic_int* stop;
+	uint64_t num_calls;
+	uint64_t duration_ns;
+	int sum;
+} bench_worker_t;
+
+static const char* bench_mode_names[] = {
+	[BENCH_MODE_DIRECT] = "direct",
+	[BENCH_MODE_LOCKED] = "locked",
+	[BENCH_MODE_LOCKED_RELOADING] = "locked+reload",
+};
+
+static bool
+bench_generate(const char* source_path) {
+	FILE* file = fopen(source_path, "w");
+	if (file == NULL) { return false; }
+
+	fprintf(file,
+		"#define REMODULE_PLUGIN_IMPLEMENTATION\n"
+		"#include \"remodule.h\"\n"
+		"\n"
+		"typedef struct { int (*call)(int arg); } bench_interface_t;\n"
+		"\n"
+		"static int\n"
+		"bench_call(int arg) {\n"
+		"\treturn arg + 1;\n"
+		"}\n"
+		"\n"
+		"static bench_interface_t bench_interface = { .call = bench_call };\n"
+		"\n"
+		"void\n"
+		"remodule_entry(remodule_op_t op, void* userdata) {\n"
+		"\t(void)userdata;\n"
+		"\tif (op == REMODULE_OP_LOAD || op == REMODULE_OP_AFTER_RELOAD) {\n"
+		"\t\tremodule_publish(remodule_self(), &bench_interface);\n"
+		"\t}\n"
+		"}\n"
+	);
+
+	return fclose(file) == 0;
+}
+
+static void*
+bench_worker(void* arg) {
+	bench_worker_t* worker = arg;
+	int sum = 0;
+	uint64_t num_calls = 0;
+	uint64_t start_ns = bench_now_ns();
+
+	if (worker->mode == BENCH_MODE_DIRECT) {
+		// Only valid because nothing reloads in this mode
+		remodule_reader_t* reader = remodule_register_reader(worker->mod);
+		bench_interface_t* interface = remodule_read_lock(reader);
+		remodule_read_unlock(reader);
+		remodule_unregister_reader(reader);
+
+		while (!atomic_load_explicit(worker->stop, memory_order_relaxed)) {
+			for (int i = 0; i < 1024; ++i) {
+				sum += interface->call(i);
+			}
+			num_calls += 1024;
+		}
+	} else {
+		remodule_reader_t* reader = remodule_register_reader(worker->mod);
+		while (!atomic_load_explicit(worker->stop, memory_order_relaxed)) {
+			for (int i = 0; i < 1024; ++i) {
+				bench_interface_t* interface = remodule_read_lock(reader);
+				sum += interface->call(i);
+				remodule_read_unlock(reader);
+			}
+			num_calls += 1024;
+		}
+		remodule_unregister_reader(reader);
+	}
+
+	worker->duration_ns = bench_now_ns() - start_ns;
+	worker->num_calls = num_calls;
+	worker->sum = sum;
+	return NULL;
+}
+
+static bool
+bench_run(const bench_options_t* options, const char* lib_path, bench_mode_t mode) {
+	// The plugin never changes, force every reload through
+	remodule_t* mod = remodule_load_ex(lib_path, NULL, &(remodule_load_options_t){ .reload_unchanged = true });
+	atomic_int stop = 0;
+
+	int num_threads = options->num_threads;
+	bench_worker_t* workers = calloc(num_threads, sizeof(bench_worker_t));
+	for (int i = 0; i < num_threads; ++i) {
+		workers[i].mod = mod;
+		workers[i].mode = mode;
+		workers[i].stop = &stop;
+		if (pthread_create(&workers[i].thread, NULL, bench_worker, &workers[i]) != 0) {
+			fprintf(stderr, "Could not start thread\n");
+			return false;
+		}
+	}
+
+	size_t max_samples = options->duration_ms + 1;
+	uint64_t* samples = malloc(max_samples * sizeof(uint64_t));
+	int num_samples = 0;
+	size_t max_retired = 0;
+	uint64_t end_ns = bench_now_ns() + (uint64_t)options->duration_ms * 1000000ull;
+	while (bench_now_ns() < end_ns) {
+		if (mode != BENCH_MODE_LOCKED_RELOADING) {
+			usleep(1000);
+			continue;
+		}
+
+		usleep(options->reload_interval_ms * 1000);
+		uint64_t start_ns = bench_now_ns();
+		if (!remodule_reload_staged(mod)) {
+			fprintf(stderr, "Reload failed: %s\n", remodule_last_error());
+			break;
+		}
+		if ((size_t)num_samples < max_samples) {
+			samples[num_samples++] = bench_now_ns() - start_ns;
+		}
+
+		size_t num_retired = remodule_stats(mod)->num_retired_instances;
+		if (num_retired > max_retired) { max_retired = num_retired; }
+	}
+	atomic_store(&stop, 1);
+
+	uint64_t total_calls = 0;
+	double total_ns_per_call = 0.0;
+	for (int i = 0; i < num_threads; ++i) {
+		pthread_join(workers[i].thread, NULL);
+		total_calls += workers[i].num_calls;
+		total_ns_per_call += (double)workers[i].duration_ns / (double)workers[i].num_calls;
+	}
+
+	printf(
+		"%-14s %8d %14.2f %12.1f",
+		bench_mode_names[mode],
+		num_threads,
+		total_ns_per_call / num_threads,
+		total_calls / (options->duration_ms / 1e3) / 1e6
+	);
+	if (num_samples > 0) {
+		qsort(samples, num_samples, sizeof(samples[0]), bench_compare_u64);
+		printf(
+			" %8d %12.1f %12.1f %8zu\n",
+			num_samples,
+			samples[num_samples * 50 / 100] / 1e3,
+			samples[num_samples * 99 / 100] / 1e3,
+			max_retired
+		);
+	} else {
+		printf(" %8s %12s %12s %8s\n", "-", "-", "-", "-");
+	}
+
+	remodule_unload(mod);
+	free(samples);
+	free(workers);
+	return true;
+}
+
+static void
+usage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"\n"
+		"Options:\n"
+		"  --threads=N      Number of worker threads (default: number of CPUs)\n"
+		"  --duration=MS    Duration of each mode in milliseconds (default: 2000)\n"
+		"  --interval=MS    Time between reloads in milliseconds (default: 10)\n"
+		"\n"
+		"Environment:\n"
+		"  CC               Compiler for the generated plugin (default: cc)\n"
+		"  TMPDIR           Where the generated plugin is written (default: /tmp)\n",
+		program
+	);
+}
+
+int
+main(int argc, const char* argv[]) {
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	bench_options_t options = {
+		.num_threads = num_cpus > 0 ? (int)num_cpus : 1,
+		.duration_ms = 2000,
+		.reload_interval_ms = 10,
+		.cc = bench_cc(),
+		.work_dir = bench_work_dir(),
+	};
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		unsigned long long value;
+		if (sscanf(arg, "--threads=%llu", &value) == 1 && value > 0) {
+			options.num_threads = (int)value;
+		} else if (sscanf(arg, "--duration=%llu", &value) == 1 && value > 0) {
+			options.duration_ms = (int)value;
+		} else if (sscanf(arg, "--interval=%llu", &value) == 1 && value > 0) {
+			options.reload_interval_ms = (int)value;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	char source_path[1024];
+	char lib_path[1024];
+	snprintf(source_path, sizeof(source_path), "%s/contention.c", options.work_dir);
+	snprintf(lib_path, sizeof(lib_path), "%s/contention.so", options.work_dir);
+	if (!bench_generate(source_path) || !bench_compile(options.cc, "-O2", source_path, lib_path)) {
+		fprintf(stderr, "Could not build plugin\n");
+		return 1;
+	}
+
+	printf(
+		"%-14s %8s %14s %12s %8s %12s %12s %8s\n",
+		"mode", "threads", "ns/call", "Mcalls/s", "reloads", "p50(us)", "p99(us)", "retired"
+	);
+	fflush(stdout);
+
+	bool ok = true;
+	for (int mode = BENCH_MODE_DIRECT; mode <= BENCH_MODE_LOCKED_RELOADING; ++mode) {
+		ok = bench_run(&options, lib_path, (bench_mode_t)mode) && ok;
+		fflush(stdout);
+	}
+
+	unlink(source_path);
+	unlink(lib_path);
+	return ok ? 0 : 1;
+}
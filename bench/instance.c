@@ -0,0 +1,166 @@
+// Instanced load benchmark.
+//
+// Loads the same generated plugin many times, once sharing the loaded image
+// and once with remodule_load_options_t::instanced, then reports the load
+// time and the resident memory added by every instance, see usage().
+
+#define REMODULE_HOST_IMPLEMENTATION
+#include "../remodule.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+typedef int (*bench_fn_t)(void);
+
+typedef struct bench_options_s {
+	int num_instances;
+	size_t data_size;
+	const char* work_dir;
+	const char* cc;
+} bench_options_t;
+
+static long
+bench_resident_kb(void) {
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file == NULL) { return 0; }
+
+	long size, resident;
+	bool ok = fscanf(file, "%ld %ld", &size, &resident) == 2;
+	fclose(file);
+	return ok ? resident * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+}
+
+static bool
+bench_generate(const bench_options_t* options, const char* source_path) {
+	FILE* file = fopen(source_path, "w");
+	if (file == NULL) { return false; }
+
+	fprintf(file,
+		"#define REMODULE_PLUGIN_IMPLEMENTATION\n"
+		"#include \"remodule.h\"\n"
+		"\n"
+		"typedef struct { unsigned char bytes[%zu]; } bench_data_t;\n"
+		"\n"
+		"REMODULE_VAR(bench_data_t, bench_data);\n"
+		"static int bench_count = 0;\n"
+		"\n"
+		"static int\n"
+		"bench_touch(void) {\n"
+		"\tfor (size_t i = 0; i < sizeof(bench_data.bytes); i += 4096) {\n"
+		"\t\tbench_data.bytes[i] = 1;\n"
+		"\t}\n"
+		"\treturn ++bench_count;\n"
+		"}\n"
+		"REMODULE_EXPORT_FN(bench_touch)\n"
+		"\n"
+		"void\n"
+		"remodule_entry(remodule_op_t op, void* userdata) {\n"
+		"\t(void)op;\n"
+		"\t(void)userdata;\n"
+		"}\n",
+		options->data_size
+	);
+
+	return fclose(file) == 0;
+}
+
+static void
+bench_run(const bench_options_t* options, const char* lib_path, bool instanced) {
+	int num_instances = options->num_instances;
+	remodule_t** mods = malloc(num_instances * sizeof(remodule_t*));
+	remodule_load_options_t load_options = { .instanced = instanced };
+
+	long start_kb = bench_resident_kb();
+	uint64_t start_ns = bench_now_ns();
+	for (int i = 0; i < num_instances; ++i) {
+		mods[i] = remodule_load_ex(lib_path, NULL, &load_options);
+	}
+	uint64_t load_ns = bench_now_ns() - start_ns;
+
+	// Each call writes every page of the module's data.
+	// A module that shares its globals counts past 1.
+	int max_count = 0;
+	for (int i = 0; i < num_instances; ++i) {
+		remodule_fn_t volatile const* touch = remodule_function(mods[i], "bench_touch");
+		int count = REMODULE_CALL(touch, bench_fn_t)();
+		if (count > max_count) { max_count = count; }
+	}
+	long added_kb = bench_resident_kb() - start_kb;
+
+	printf(
+		"%-10s %10d %14.1f %14.1f %10s\n",
+		instanced ? "instanced" : "shared",
+		num_instances,
+		load_ns / 1e3 / num_instances,
+		(double)added_kb / num_instances,
+		max_count == 1 ? "yes" : "no"
+	);
+
+	for (int i = 0; i < num_instances; ++i) {
+		remodule_unload(mods[i]);
+	}
+	free(mods);
+}
+
+static void
+usage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"\n"
+		"Options:\n"
+		"  --instances=N    Number of loads of the plugin (default: 64)\n"
+		"  --data=BYTES     Size of the plugin's data (default: 65536)\n"
+		"\n"
+		"Environment:\n"
+		"  CC               Compiler for the generated plugin (default: cc)\n"
+		"  TMPDIR           Where the generated plugin is written (default: /tmp)\n",
+		program
+	);
+}
+
+int
+main(int argc, const char* argv[]) {
+	bench_options_t options = {
+		.num_instances = 64,
+		.data_size = 65536,
+		.cc = bench_cc(),
+		.work_dir = bench_work_dir(),
+	};
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		unsigned long long value;
+		if (sscanf(arg, "--instances=%llu", &value) == 1 && value > 0) {
+			options.num_instances = (int)value;
+		} else if (sscanf(arg, "--data=%llu", &value) == 1 && value > 0) {
+			options.data_size = (size_t)value;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	char source_path[1024];
+	char lib_path[1024];
+	snprintf(source_path, sizeof(source_path), "%s/instance.c", options.work_dir);
+	snprintf(lib_path, sizeof(lib_path), "%s/instance.so", options.work_dir);
+	if (!bench_generate(&options, source_path) || !bench_compile(options.cc, "-O2", source_path, lib_path)) {
+		fprintf(stderr, "Could not build plugin\n");
+		return 1;
+	}
+
+	printf("%-10s %10s %14s %14s %10s\n", "mode", "instances", "load(us)", "rss(KiB)", "isolated");
+	fflush(stdout);
+
+	bench_run(&options, lib_path, false);
+	bench_run(&options, lib_path, true);
+
+	unlink(source_path);
+	unlink(lib_path);
+	return 0;
+}
@@ -0,0 +1,240 @@
+// Monitor scaling benchmark.
+//
+// Spreads many monitored files over many directories, then times creating
+// the monitors, dispatching change events to them and removing them.
+// It then writes unrelated files next to the monitored ones, like a build
+// directory does, and counts the reads of the event queue per change.
+// Monitors are created straight from paths so that the numbers are not
+// dominated by loading thousands of modules, see usage().
+
+#define REMODULE_HOST_IMPLEMENTATION
+#include "../remodule.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+// Count the reads of the monitor implementation, the only ones after this
+static uint64_t bench_num_reads = 0;
+
+static ssize_t
+bench_read(int fd, void* buf, size_t size) {
+	++bench_num_reads;
+	return read(fd, buf, size);
+}
+
+#define read bench_read
+#define REMODULE_MONITOR_IMPLEMENTATION
+#include "../remodule_monitor.h"
+#undef read
+
+typedef struct bench_options_s {
+	int num_monitors;
+	int num_dirs;
+	int num_events;
+	int churn;
+	const char* work_dir;
+} bench_options_t;
+
+static void
+bench_dir_path(const bench_options_t* options, int dir, char* buf, size_t size) {
+	snprintf(buf, size, "%s/remodule-monitor-bench/%d", options->work_dir, dir);
+}
+
+static void
+bench_file_path(const bench_options_t* options, int index, char* buf, size_t size) {
+	snprintf(
+		buf, size,
+		"%s/remodule-monitor-bench/%d/plugin-%d.so",
+		options->work_dir, index % options->num_dirs, index
+	);
+}
+
+static void
+bench_churn_path(const bench_options_t* options, int dir, int index, char* buf, size_t size) {
+	snprintf(buf, size, "%s/remodule-monitor-bench/%d/object-%d.o", options->work_dir, dir, index);
+}
+
+static bool
+bench_touch(const char* path) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) { return false; }
+	return close(fd) == 0;
+}
+
+static void
+bench_report(const char* op, uint64_t duration_ns, int count, uint64_t num_reads) {
+	printf(
+		"%-12s %10d %12.1f %12.3f %12.3f\n",
+		op, count, (double)duration_ns / count, duration_ns / 1e6, (double)num_reads / count
+	);
+}
+
+static void
+usage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"\n"
+		"Options:\n"
+		"  --monitors=N     Number of monitored files (default: 10000)\n"
+		"  --dirs=N         Number of directories they are spread over (default: 500)\n"
+		"  --events=N       Number of file changes to dispatch (default: 10000)\n"
+		"  --churn=N        Unrelated files written per change in the churn test (default: 20)\n"
+		"\n"
+		"Environment:\n"
+		"  TMPDIR           Where the monitored files are written (default: /tmp)\n",
+		program
+	);
+}
+
+int
+main(int argc, const char* argv[]) {
+	bench_options_t options = {
+		.num_monitors = 10000,
+		.num_dirs = 500,
+		.num_events = 10000,
+		.churn = 20,
+		.work_dir = bench_work_dir(),
+	};
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		unsigned long long value;
+		if (sscanf(arg, "--monitors=%llu", &value) == 1 && value > 0) {
+			options.num_monitors = (int)value;
+		} else if (sscanf(arg, "--dirs=%llu", &value) == 1 && value > 0) {
+			options.num_dirs = (int)value;
+		} else if (sscanf(arg, "--events=%llu", &value) == 1 && value > 0) {
+			options.num_events = (int)value;
+		} else if (sscanf(arg, "--churn=%llu", &value) == 1) {
+			options.churn = (int)value;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/remodule-monitor-bench", options.work_dir);
+	mkdir(path, 0755);
+	for (int i = 0; i < options.num_dirs; ++i) {
+		bench_dir_path(&options, i, path, sizeof(path));
+		mkdir(path, 0755);
+	}
+	for (int i = 0; i < options.num_monitors; ++i) {
+		bench_file_path(&options, i, path, sizeof(path));
+		if (!bench_touch(path)) {
+			fprintf(stderr, "Could not create %s\n", path);
+			return 1;
+		}
+	}
+
+	int num_monitors = options.num_monitors;
+	remodule_monitor_t** monitors = malloc(sizeof(remodule_monitor_t*) * num_monitors);
+
+	printf("%-12s %10s %12s %12s %12s\n", "op", "count", "ns/op", "total(ms)", "reads/op");
+
+	uint64_t start_ns = bench_now_ns();
+	for (int i = 0; i < num_monitors; ++i) {
+		bench_file_path(&options, i, path, sizeof(path));
+		monitors[i] = remodule_monitor_create(NULL, path, NULL);
+	}
+	bench_report("monitor", bench_now_ns() - start_ns, num_monitors, 0);
+
+	// Touch files in batches small enough not to overflow the event queue
+	bool ok = true;
+	int batch_size = 4096;
+	uint64_t dispatch_ns = 0;
+	bench_num_reads = 0;
+	for (int first = 0; first < options.num_events; first += batch_size) {
+		int count = options.num_events - first < batch_size ? options.num_events - first : batch_size;
+		for (int i = first; i < first + count; ++i) {
+			// Spread the changes over monitors with a stride coprime to most counts
+			bench_file_path(&options, (int)((i * 7919ull) % num_monitors), path, sizeof(path));
+			bench_touch(path);
+		}
+
+		start_ns = bench_now_ns();
+		remodule_dirmon_update_all();
+		dispatch_ns += bench_now_ns() - start_ns;
+
+		for (int i = first; i < first + count; ++i) {
+			remodule_monitor_t* mon = monitors[(i * 7919ull) % num_monitors];
+			if (mon->loaded_version == mon->latest_version) {
+				fprintf(stderr, "Missed an event\n");
+				ok = false;
+			}
+		}
+		for (int i = 0; i < num_monitors; ++i) {
+			monitors[i]->loaded_version = monitors[i]->latest_version;
+		}
+	}
+	bench_report("dispatch", dispatch_ns, options.num_events, bench_num_reads);
+
+	// Same, with every change buried under unrelated files in its directory
+	int churn = options.churn;
+	batch_size = 8192 / (churn + 1);
+	if (batch_size == 0) { batch_size = 1; }
+	dispatch_ns = 0;
+	bench_num_reads = 0;
+	for (int first = 0; first < options.num_events; first += batch_size) {
+		int count = options.num_events - first < batch_size ? options.num_events - first : batch_size;
+		for (int i = first; i < first + count; ++i) {
+			int index = (int)((i * 7919ull) % num_monitors);
+			for (int j = 0; j < churn; ++j) {
+				bench_churn_path(&options, index % options.num_dirs, j, path, sizeof(path));
+				bench_touch(path);
+			}
+			bench_file_path(&options, index, path, sizeof(path));
+			bench_touch(path);
+		}
+
+		start_ns = bench_now_ns();
+		remodule_dirmon_update_all();
+		dispatch_ns += bench_now_ns() - start_ns;
+
+		for (int i = first; i < first + count; ++i) {
+			remodule_monitor_t* mon = monitors[(i * 7919ull) % num_monitors];
+			if (mon->loaded_version == mon->latest_version) {
+				fprintf(stderr, "Missed an event\n");
+				ok = false;
+			}
+		}
+		for (int i = 0; i < num_monitors; ++i) {
+			monitors[i]->loaded_version = monitors[i]->latest_version;
+		}
+	}
+	bench_report("churn", dispatch_ns, options.num_events, bench_num_reads);
+
+	start_ns = bench_now_ns();
+	for (int i = 0; i < num_monitors; ++i) {
+		remodule_unmonitor(monitors[i]);
+	}
+	bench_report("unmonitor", bench_now_ns() - start_ns, num_monitors, 0);
+
+	for (int i = 0; i < num_monitors; ++i) {
+		bench_file_path(&options, i, path, sizeof(path));
+		unlink(path);
+	}
+	for (int i = 0; i < options.num_dirs; ++i) {
+		for (int j = 0; j < churn; ++j) {
+			bench_churn_path(&options, i, j, path, sizeof(path));
+			unlink(path);
+		}
+	}
+	for (int i = 0; i < options.num_dirs; ++i) {
+		bench_dir_path(&options, i, path, sizeof(path));
+		rmdir(path);
+	}
+	snprintf(path, sizeof(path), "%s/remodule-monitor-bench", options.work_dir);
+	rmdir(path);
+
+	free(monitors);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,306 @@
+// Reload latency benchmark.
+//
+// Generates synthetic plugins, then times remodule_load and every reload
+// flavour end to end.
+// Run without arguments for the default suite or pass options to run a
+// single scenario, see usage().
+
+#define REMODULE_HOST_IMPLEMENTATION
+#include "../remodule.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+typedef struct bench_scenario_s {
+	const char* name;
+	size_t num_vars;
+	size_t var_size;
+	size_t num_host_vars;
+	size_t num_exports;
+	unsigned init_us;
+} bench_scenario_t;
+
+typedef struct bench_options_s {
+	int iterations;
+	const char* work_dir;
+	const char* cc;
+} bench_options_t;
+
+static const bench_scenario_t bench_default_suite[] = {
+	{ .name = "baseline", .num_vars = 1, .var_size = 8 },
+	{ .name = "vars-1k", .num_vars = 1000, .var_size = 8 },
+	{ .name = "vars-10k", .num_vars = 10000, .var_size = 8 },
+	{ .name = "vars-100k", .num_vars = 100000, .var_size = 8 },
+	{ .name = "var-1MB", .num_vars = 1, .var_size = 1 << 20 },
+	{ .name = "var-64MB", .num_vars = 1, .var_size = 64 << 20 },
+	{ .name = "var-256MB", .num_vars = 1, .var_size = 256 << 20 },
+	{ .name = "host-256MB", .num_host_vars = 1, .var_size = 256 << 20 },
+	{ .name = "exports-1k", .num_vars = 1, .var_size = 8, .num_exports = 1000 },
+	{ .name = "exports-10k", .num_vars = 1, .var_size = 8, .num_exports = 10000 },
+	{ .name = "init-1ms", .num_vars = 1, .var_size = 8, .init_us = 1000 },
+	{ .name = "init-10ms", .num_vars = 1, .var_size = 8, .init_us = 10000 },
+};
+
+static bool
+bench_generate(const bench_scenario_t* scenario, const char* source_path) {
+	FILE* file = fopen(source_path, "w");
+	if (file == NULL) { return false; }
+
+	fprintf(file,
+		"#define REMODULE_PLUGIN_IMPLEMENTATION\n"
+		"#include \"remodule.h\"\n"
+		"#include <time.h>\n"
+		"\n"
+		"typedef struct { unsigned char bytes[%zu]; } bench_var_t;\n"
+		"\n",
+		scenario->var_size
+	);
+
+	for (size_t i = 0; i < scenario->num_vars; ++i) {
+		fprintf(file, "REMODULE_VAR(bench_var_t, bench_var_%zu);\n", i);
+	}
+	for (size_t i = 0; i < scenario->num_host_vars; ++i) {
+		fprintf(file, "REMODULE_HOST_VAR(bench_var_t, bench_host_var_%zu);\n", i);
+	}
+
+	// Default visibility functions referenced through a table: one symbolic
+	// relocation and one relative relocation each
+	for (size_t i = 0; i < scenario->num_exports; ++i) {
+		fprintf(file,
+			"__attribute__((visibility(\"default\"))) int bench_fn_%zu(void) { return %zu; }\n",
+			i, i
+		);
+	}
+	fprintf(file, "int (*const bench_fns[])(void) = {\n");
+	for (size_t i = 0; i < scenario->num_exports; ++i) {
+		fprintf(file, "\tbench_fn_%zu,\n", i);
+	}
+	fprintf(file, "\tNULL,\n};\n\n");
+
+	fprintf(file,
+		"__attribute__((constructor)) static void\n"
+		"bench_init(void) {\n"
+		"\tstruct timespec start, now;\n"
+		"\tclock_gettime(CLOCK_MONOTONIC, &start);\n"
+		"\tdo {\n"
+		"\t\tclock_gettime(CLOCK_MONOTONIC, &now);\n"
+		"\t} while ((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000L < %uL);\n"
+		"}\n"
+		"\n"
+		"void\n"
+		"remodule_entry(remodule_op_t op, void* userdata) {\n"
+		"\t(void)op;\n"
+		"\t(void)userdata;\n"
+		"}\n",
+		scenario->init_us
+	);
+
+	return fclose(file) == 0;
+}
+
+static void
+bench_report(const char* scenario, const char* op, uint64_t* samples, int num_samples) {
+	qsort(samples, num_samples, sizeof(samples[0]), bench_compare_u64);
+
+	double p50 = samples[num_samples * 50 / 100] / 1e3;
+	double p90 = samples[num_samples * 90 / 100] / 1e3;
+	double p99 = samples[num_samples * 99 / 100] / 1e3;
+	double max = samples[num_samples - 1] / 1e3;
+	printf(
+		"%-12s %-14s %12.1f %12.1f %12.1f %12.1f\n",
+		scenario, op, p50, p90, p99, max
+	);
+}
+
+static void
+bench_report_phases(const char* scenario, remodule_t* mod) {
+	static const char* phase_names[REMODULE_PHASE_COUNT] = {
+		[REMODULE_PHASE_BEFORE_RELOAD] = "before_reload",
+		[REMODULE_PHASE_SNAPSHOT] = "snapshot",
+		[REMODULE_PHASE_CLOSE] = "close",
+		[REMODULE_PHASE_OPEN] = "open",
+		[REMODULE_PHASE_RESTORE] = "restore",
+		[REMODULE_PHASE_AFTER_RELOAD] = "after_reload",
+	};
+
+	const remodule_stats_t* stats = remodule_stats(mod);
+	printf("%-12s phases(mean us):", scenario);
+	for (int i = 0; i < REMODULE_PHASE_COUNT; ++i) {
+		printf(
+			" %s=%.1f",
+			phase_names[i],
+			stats->phases[i].total_ns / 1e3 / (stats->reload_count > 0 ? stats->reload_count : 1)
+		);
+	}
+	printf("\n");
+}
+
+static bool
+bench_run(const bench_options_t* options, const bench_scenario_t* scenario) {
+	char source_path[1024];
+	char lib_path[1024];
+	snprintf(source_path, sizeof(source_path), "%s/%s.c", options->work_dir, scenario->name);
+	snprintf(lib_path, sizeof(lib_path), "%s/%s.so", options->work_dir, scenario->name);
+
+	if (!bench_generate(scenario, source_path)) {
+		fprintf(stderr, "%s: could not generate plugin\n", scenario->name);
+		return false;
+	}
+	if (!bench_compile(options->cc, "-O1", source_path, lib_path)) {
+		fprintf(stderr, "%s: could not compile plugin\n", scenario->name);
+		return false;
+	}
+
+	int iterations = options->iterations;
+	uint64_t* samples = malloc(iterations * sizeof(uint64_t));
+
+	for (int i = 0; i < iterations; ++i) {
+		uint64_t start_ns = bench_now_ns();
+		remodule_t* mod = remodule_load(lib_path, NULL);
+		samples[i] = bench_now_ns() - start_ns;
+		remodule_unload(mod);
+	}
+	bench_report(scenario->name, "load", samples, iterations);
+
+	remodule_t* mod = remodule_load(lib_path, NULL);
+	for (int i = 0; i < iterations; ++i) {
+		uint64_t start_ns = bench_now_ns();
+		if (remodule_reload(mod)) {
+			fprintf(stderr, "%s: unchanged module was reloaded\n", scenario->name);
+			return false;
+		}
+		samples[i] = bench_now_ns() - start_ns;
+	}
+	bench_report(scenario->name, "reload_noop", samples, iterations);
+	remodule_unload(mod);
+
+	// The plugin never changes, force every reload through
+	mod = remodule_load_ex(lib_path, NULL, &(remodule_load_options_t){ .reload_unchanged = true });
+
+	for (int i = 0; i < iterations; ++i) {
+		uint64_t start_ns = bench_now_ns();
+		remodule_reload(mod);
+		samples[i] = bench_now_ns() - start_ns;
+	}
+	bench_report(scenario->name, "reload", samples, iterations);
+
+	for (int i = 0; i < iterations; ++i) {
+		uint64_t start_ns = bench_now_ns();
+		if (!remodule_reload_staged(mod)) {
+			fprintf(stderr, "%s: staged reload failed: %s\n", scenario->name, remodule_last_error());
+			return false;
+		}
+		samples[i] = bench_now_ns() - start_ns;
+	}
+	bench_report(scenario->name, "reload_staged", samples, iterations);
+
+	// Only the swap blocks the caller
+	for (int i = 0; i < iterations; ++i) {
+		remodule_reload_begin(mod);
+		while (remodule_reload_poll(mod) == REMODULE_RELOAD_PENDING) {
+			usleep(100);
+		}
+
+		uint64_t start_ns = bench_now_ns();
+		if (!remodule_reload_commit(mod)) {
+			fprintf(stderr, "%s: commit failed: %s\n", scenario->name, remodule_reload_error(mod));
+			return false;
+		}
+		samples[i] = bench_now_ns() - start_ns;
+	}
+	bench_report(scenario->name, "reload_commit", samples, iterations);
+
+	bench_report_phases(scenario->name, mod);
+	remodule_unload(mod);
+	free(samples);
+
+	unlink(source_path);
+	unlink(lib_path);
+	return true;
+}
+
+static void
+usage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"\n"
+		"Without scenario options, the default suite is run.\n"
+		"\n"
+		"Options:\n"
+		"  --iterations=N   Number of samples per operation (default: 50)\n"
+		"  --vars=N         Number of REMODULE_VARs\n"
+		"  --host-vars=N    Number of REMODULE_HOST_VARs\n"
+		"  --var-size=N     Size of each REMODULE_VAR or REMODULE_HOST_VAR in bytes\n"
+		"  --exports=N      Number of exported functions\n"
+		"  --init-us=N      Cost of the static initializer in microseconds\n"
+		"\n"
+		"Environment:\n"
+		"  CC               Compiler for the generated plugins (default: cc)\n"
+		"  TMPDIR           Where the generated plugins are written (default: /tmp)\n",
+		program
+	);
+}
+
+int
+main(int argc, const char* argv[]) {
+	bench_options_t options = {
+		.iterations = 50,
+		.cc = bench_cc(),
+		.work_dir = bench_work_dir(),
+	};
+	bench_scenario_t custom = {
+		.name = "custom",
+		.num_vars = 1,
+		.var_size = 8,
+	};
+	bool run_custom = false;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		unsigned long long value;
+		if (sscanf(arg, "--iterations=%llu", &value) == 1 && value > 0) {
+			options.iterations = (int)value;
+		} else if (sscanf(arg, "--vars=%llu", &value) == 1) {
+			custom.num_vars = (size_t)value;
+			run_custom = true;
+		} else if (sscanf(arg, "--host-vars=%llu", &value) == 1) {
+			custom.num_host_vars = (size_t)value;
+			run_custom = true;
+		} else if (sscanf(arg, "--var-size=%llu", &value) == 1 && value > 0) {
+			custom.var_size = (size_t)value;
+			run_custom = true;
+		} else if (sscanf(arg, "--exports=%llu", &value) == 1) {
+			custom.num_exports = (size_t)value;
+			run_custom = true;
+		} else if (sscanf(arg, "--init-us=%llu", &value) == 1) {
+			custom.init_us = (unsigned)value;
+			run_custom = true;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	printf(
+		"%-12s %-14s %12s %12s %12s %12s\n",
+		"scenario", "op", "p50(us)", "p90(us)", "p99(us)", "max(us)"
+	);
+	fflush(stdout);
+
+	bool ok = true;
+	if (run_custom) {
+		ok = bench_run(&options, &custom);
+	} else {
+		for (size_t i = 0; i < sizeof(bench_default_suite) / sizeof(bench_default_suite[0]); ++i) {
+			ok = bench_run(&options, &bench_default_suite[i]) && ok;
+			fflush(stdout);
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -36,6 +36,9 @@ project "host"
    "example_host.c",
   }
 
+  filter "system:linux"
+    links { "pthread" }
+
   filter "configurations:Debug"
     defines { "DEBUG" }
     symbols "On"
@@ -20,7 +20,9 @@
 #define _GNU_SOURCE
 #endif
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 //! @cond remodule_internal
 
@@ -57,6 +59,7 @@
  * @remarks
  *   If the type of the variable changes between reloads, it will not be preserved.
  *   The new instance will have the variable at its initial value.
+ *   Use @ref REMODULE_VAR_LAYOUT to preserve variables whose type changes.
  *
  * @remarks
  *   Only a shallow copy will be made using `memcpy` to migrate data from the old
@@ -66,6 +69,8 @@
  *   As long as the plugin uses the host's allocator or its allocator's state
  *   is preserved, everything should work out
  *   of the box.
+ *   @ref remodule_arena_alloc and @ref remodule_pool_alloc provide such an
+ *   allocator.
  *
  * @remarks
  *   On the other hand, pointers to static data in the plugin or structures
@@ -100,6 +105,363 @@
 	const remodule_var_info_t* const REMODULE__META_PTR_NAME(NAME) = &REMODULE__META_NAME(NAME); \
 	REMODULE__SECTION_END \
 
+/**
+ * @brief Declare a variable in the plugin whose storage is owned by the host.
+ *
+ * `NAME` is declared as a pointer to `TYPE`.
+ * Before @ref REMODULE_OP_LOAD and @ref REMODULE_OP_AFTER_RELOAD, it is bound
+ * to storage that the host keeps across reloads, so nothing is copied when
+ * reloading.
+ *
+ * Example:
+ * @code{.c}
+ * REMODULE_HOST_VAR(lookup_table_t, table);
+ *
+ * static int
+ * lookup(int key) {
+ *     return table->values[key];
+ * }
+ * @endcode
+ *
+ * @param TYPE The type of the variable.
+ * @param NAME The name of the variable.
+ *   This must be unique within each plugin.
+ *
+ * @remarks
+ *   The storage is zero-initialized when it is first created.
+ *
+ * @remarks
+ *   If the size or alignment of `TYPE` changes between reloads, the old
+ *   storage is released and the new instance gets zero-initialized storage.
+ *
+ * @remarks
+ *   Storage is released on @ref remodule_unload or when a new instance no
+ *   longer declares the variable.
+ *   In the latter case, it is released along with the old instance, once no
+ *   @link remodule_read_lock reader @endlink can be using it.
+ *   It is not part of snapshot files.
+ *
+ * @see REMODULE_VAR
+ */
+#define REMODULE_HOST_VAR(TYPE, NAME) \
+	extern TYPE* NAME; \
+	const remodule_var_info_t REMODULE__META_NAME(NAME) = { \
+		.name = #NAME, \
+		.name_length = sizeof(#NAME) - 1, \
+		.value_addr = &NAME, \
+		.value_size = sizeof(TYPE), \
+		.value_align = _Alignof(TYPE), \
+		.flags = REMODULE_VAR_FLAG_HOST_OWNED, \
+	}; \
+	REMODULE__SECTION_BEGIN \
+	const remodule_var_info_t* const REMODULE__META_PTR_NAME(NAME) = &REMODULE__META_NAME(NAME); \
+	REMODULE__SECTION_END \
+	TYPE* NAME
+
+/**
+ * @brief Declare a variable in the plugin that is eligible for state transfer, along with its layout.
+ *
+ * Example:
+ * @code{.c}
+ * typedef struct {
+ *     int num_hits;
+ *     float ratio;
+ * } cache_stats_t;
+ *
+ * REMODULE_VAR_LAYOUT(cache_stats_t, stats, NULL,
+ *     REMODULE_FIELD(cache_stats_t, num_hits, int),
+ *     REMODULE_FIELD(cache_stats_t, ratio, float)
+ * ) = { 0 };
+ * @endcode
+ *
+ * If the layout is different between the old and the new instance, fields are
+ * transferred one by one.
+ * A field is transferred when the new instance has a field with the same name,
+ * type and size.
+ * Fields that were added keep their initial value.
+ *
+ * @param TYPE The type of the variable.
+ * @param NAME The name of the variable.
+ *   This must be unique within each plugin.
+ * @param MIGRATE A @ref remodule_migrate_fn_t or `NULL`.
+ *   It is called after fields are transferred whenever the layout changed.
+ * @param ... A list of @ref REMODULE_FIELD.
+ *
+ * @see REMODULE_VAR
+ */
+#define REMODULE_VAR_LAYOUT(TYPE, NAME, MIGRATE, ...) \
+	extern TYPE NAME; \
+	REMODULE_PERSIST_VAR_LAYOUT(NAME, MIGRATE, __VA_ARGS__) \
+	TYPE NAME
+
+/**
+ * @brief Mark an existing variable for state transfer, along with its layout.
+ *
+ * @see REMODULE_VAR_LAYOUT
+ * @see REMODULE_PERSIST_VAR
+ */
+#define REMODULE_PERSIST_VAR_LAYOUT(NAME, MIGRATE, ...) \
+	static const remodule_field_info_t REMODULE__FIELDS_NAME(NAME)[] = { __VA_ARGS__ }; \
+	const remodule_var_info_t REMODULE__META_NAME(NAME) = { \
+		.name = #NAME, \
+		.name_length = sizeof(#NAME) - 1, \
+		.value_addr = &NAME, \
+		.value_size = sizeof(NAME), \
+		.fields = REMODULE__FIELDS_NAME(NAME), \
+		.num_fields = sizeof(REMODULE__FIELDS_NAME(NAME)) / sizeof(remodule_field_info_t), \
+		.migrate = MIGRATE, \
+	}; \
+	REMODULE__SECTION_BEGIN \
+	const remodule_var_info_t* const REMODULE__META_PTR_NAME(NAME) = &REMODULE__META_NAME(NAME); \
+	REMODULE__SECTION_END \
+
+/**
+ * @brief Describe a field for @ref REMODULE_VAR_LAYOUT.
+ *
+ * @param STRUCT The type of the variable.
+ * @param FIELD The name of the field.
+ * @param FIELD_TYPE The type of the field.
+ *   It is compared as spelled so it should be spelled consistently.
+ */
+#define REMODULE_FIELD(STRUCT, FIELD, FIELD_TYPE) \
+	{ \
+		.name = #FIELD, \
+		.name_length = sizeof(#FIELD) - 1, \
+		.type_name = #FIELD_TYPE, \
+		.type_name_length = sizeof(#FIELD_TYPE) - 1, \
+		.offset = offsetof(STRUCT, FIELD), \
+		.size = sizeof(((STRUCT*)0)->FIELD), \
+	}
+
+/**
+ * @brief Describe a pointer field for @ref REMODULE_VAR_LAYOUT.
+ *
+ * On reload, if the field points into a persisted variable or a
+ * @link REMODULE_RELOCATABLE relocatable symbol @endlink of the old instance,
+ * it is updated to point to the same place in the new instance.
+ * A pointer into a symbol that no longer exists is set to `NULL`.
+ * Other pointers, such as those to heap memory, are left as is.
+ *
+ * The field can also be an array of pointers.
+ *
+ * @remarks
+ *   Only pointers that are described this way are updated.
+ *   Pointers that are not reachable from a field of a persisted variable,
+ *   such as those inside heap memory or C++ vtable pointers, still point into
+ *   the old instance after a reload.
+ *
+ * @see REMODULE_FIELD
+ */
+#define REMODULE_FIELD_PTR(STRUCT, FIELD, FIELD_TYPE) \
+	{ \
+		.name = #FIELD, \
+		.name_length = sizeof(#FIELD) - 1, \
+		.type_name = #FIELD_TYPE, \
+		.type_name_length = sizeof(#FIELD_TYPE) - 1, \
+		.offset = offsetof(STRUCT, FIELD), \
+		.size = sizeof(((STRUCT*)0)->FIELD), \
+		.flags = REMODULE_FIELD_FLAG_POINTER, \
+	}
+
+/**
+ * @brief Let pointers to a static variable survive reloads.
+ *
+ * Pointers described with @ref REMODULE_FIELD_PTR that point into this
+ * variable are updated to point into the variable of the same name in the new
+ * instance.
+ *
+ * Example:
+ * @code{.c}
+ * static const char greeting[] = "Hello";
+ * REMODULE_RELOCATABLE(greeting)
+ * @endcode
+ *
+ * @remarks
+ *   Persisted variables are always relocatable.
+ */
+#define REMODULE_RELOCATABLE(NAME) \
+	const remodule_var_info_t REMODULE__META_NAME(NAME) = { \
+		.name = #NAME, \
+		.name_length = sizeof(#NAME) - 1, \
+		.value_addr = (void*)&NAME, \
+		.value_size = sizeof(NAME), \
+		.flags = REMODULE_VAR_FLAG_RELOCATABLE, \
+	}; \
+	REMODULE__SECTION_BEGIN \
+	const remodule_var_info_t* const REMODULE__META_PTR_NAME(NAME) = &REMODULE__META_NAME(NAME); \
+	REMODULE__SECTION_END \
+
+/**
+ * @brief Let pointers to a function survive reloads.
+ *
+ * @see REMODULE_RELOCATABLE
+ */
+#define REMODULE_RELOCATABLE_FN(NAME) \
+	const remodule_var_info_t REMODULE__META_NAME(NAME) = { \
+		.name = #NAME, \
+		.name_length = sizeof(#NAME) - 1, \
+		.fn_addr = (void(*)(void))NAME, \
+		.value_size = 1, \
+		.flags = REMODULE_VAR_FLAG_RELOCATABLE, \
+	}; \
+	REMODULE__SECTION_BEGIN \
+	const remodule_var_info_t* const REMODULE__META_PTR_NAME(NAME) = &REMODULE__META_NAME(NAME); \
+	REMODULE__SECTION_END \
+
+/**
+ * @brief Export a function of the plugin to the host.
+ *
+ * The host calls it through a stable entry point from
+ * @ref remodule_function, which keeps pointing to the current instance of
+ * the function across reloads.
+ *
+ * Example:
+ * @code{.c}
+ * static int
+ * add(int a, int b) {
+ *     return a + b;
+ * }
+ * REMODULE_EXPORT_FN(add)
+ * @endcode
+ *
+ * @remarks
+ *   Exported functions are also @link REMODULE_RELOCATABLE_FN relocatable @endlink.
+ */
+#define REMODULE_EXPORT_FN(NAME) \
+	const remodule_var_info_t REMODULE__META_NAME(NAME) = { \
+		.name = #NAME, \
+		.name_length = sizeof(#NAME) - 1, \
+		.fn_addr = (void(*)(void))NAME, \
+		.value_size = 1, \
+		.flags = REMODULE_VAR_FLAG_RELOCATABLE | REMODULE_VAR_FLAG_EXPORTED, \
+	}; \
+	REMODULE__SECTION_BEGIN \
+	const remodule_var_info_t* const REMODULE__META_PTR_NAME(NAME) = &REMODULE__META_NAME(NAME); \
+	REMODULE__SECTION_END \
+
+/**
+ * @brief Export a function of the plugin at a fixed index of the export table.
+ *
+ * The index is usually an enumerator from a header shared between the host
+ * and its plugins.
+ * The host finds the function with @ref remodule_exports without any
+ * symbol lookup.
+ *
+ * Example:
+ * @code{.c}
+ * // In the shared header
+ * enum { PLUGIN_EXPORT_UPDATE, PLUGIN_EXPORT_CONFIG, PLUGIN_EXPORT_COUNT };
+ *
+ * // In the plugin
+ * static void
+ * update(void) {
+ * }
+ * REMODULE_EXPORT_FN_AT(PLUGIN_EXPORT_UPDATE, update)
+ * @endcode
+ *
+ * @remarks
+ *   The function can also be found by name with @ref remodule_function.
+ * @remarks
+ *   Every index can only be given to one export of the plugin.
+ */
+#define REMODULE_EXPORT_FN_AT(ID, NAME) \
+	const remodule_var_info_t REMODULE__META_NAME(NAME) = { \
+		.name = #NAME, \
+		.name_length = sizeof(#NAME) - 1, \
+		.fn_addr = (void(*)(void))NAME, \
+		.value_size = 1, \
+		.export_id = (ID), \
+		.flags = REMODULE_VAR_FLAG_RELOCATABLE | REMODULE_VAR_FLAG_EXPORTED | REMODULE_VAR_FLAG_INDEXED, \
+	}; \
+	REMODULE__SECTION_BEGIN \
+	const remodule_var_info_t* const REMODULE__META_PTR_NAME(NAME) = &REMODULE__META_NAME(NAME); \
+	REMODULE__SECTION_END \
+
+/**
+ * @brief Export a variable of the plugin at a fixed index of the export table.
+ *
+ * @see REMODULE_EXPORT_FN_AT
+ */
+#define REMODULE_EXPORT_DATA_AT(ID, NAME) \
+	const remodule_var_info_t REMODULE__META_NAME(NAME) = { \
+		.name = #NAME, \
+		.name_length = sizeof(#NAME) - 1, \
+		.value_addr = (void*)&NAME, \
+		.value_size = sizeof(NAME), \
+		.export_id = (ID), \
+		.flags = REMODULE_VAR_FLAG_RELOCATABLE | REMODULE_VAR_FLAG_INDEXED, \
+	}; \
+	REMODULE__SECTION_BEGIN \
+	const remodule_var_info_t* const REMODULE__META_PTR_NAME(NAME) = &REMODULE__META_NAME(NAME); \
+	REMODULE__SECTION_END \
+
+/**
+ * @brief Declare a thread-local variable in the plugin that is preserved across reloads.
+ *
+ * Each thread gets its own zero-initialized storage, owned by the host.
+ * A reload does not copy anything: the new instance finds the same storage
+ * the first time each thread accesses the variable.
+ *
+ * The variable is accessed through @ref REMODULE_TLS.
+ *
+ * Example:
+ * @code{.c}
+ * REMODULE_TLS_VAR(parse_buffer_t, parse_buffer);
+ *
+ * static void
+ * parse(const char* input) {
+ *     parse_buffer_t* buffer = &REMODULE_TLS(parse_buffer);
+ * }
+ * @endcode
+ *
+ * @param TYPE The type of the variable.
+ * @param NAME The name of the variable.
+ *   This must be unique within each plugin.
+ *
+ * @remarks
+ *   If the size or alignment of `TYPE` changes between reloads, each thread
+ *   gets new zero-initialized storage.
+ *
+ * @remarks
+ *   The storage of a thread is released when the thread exits, and that of
+ *   every thread on @ref remodule_unload.
+ *   A thread must not access the variable from its own `pthread` key or
+ *   fiber local storage destructors.
+ *   It is not part of snapshot files.
+ *
+ * @see REMODULE_HOST_VAR
+ */
+#define REMODULE_TLS_VAR(TYPE, NAME) \
+	const remodule_var_info_t REMODULE__META_NAME(NAME) = { \
+		.name = #NAME, \
+		.name_length = sizeof(#NAME) - 1, \
+		.value_size = sizeof(TYPE), \
+		.value_align = _Alignof(TYPE), \
+		.flags = REMODULE_VAR_FLAG_THREAD_LOCAL, \
+	}; \
+	REMODULE__SECTION_BEGIN \
+	const remodule_var_info_t* const REMODULE__META_PTR_NAME(NAME) = &REMODULE__META_NAME(NAME); \
+	REMODULE__SECTION_END \
+	REMODULE__THREAD_LOCAL TYPE* REMODULE__TLS_NAME(NAME)
+
+/**
+ * @brief Access a variable declared with @ref REMODULE_TLS_VAR.
+ *
+ * This is an lvalue of the variable's type for the calling thread.
+ * Past the first access of a thread after each (re)load, this costs a
+ * thread-local load and a branch.
+ */
+#define REMODULE_TLS(NAME) \
+	(*(REMODULE__TLS_NAME(NAME) != NULL \
+		? REMODULE__TLS_NAME(NAME) \
+		: (REMODULE__TLS_NAME(NAME) = remodule__tls_bind(&REMODULE__META_NAME(NAME)))))
+
+#if defined(_MSC_VER)
+#	define REMODULE__THREAD_LOCAL __declspec(thread)
+#else
+#	define REMODULE__THREAD_LOCAL _Thread_local
+#endif
+
 #if defined(_MSC_VER)
 #	define REMODULE__SECTION_BEGIN \
 	__pragma(data_seg(push)); \
@@ -113,6 +475,38 @@
 #	error Unsupported compiler
 #endif
 
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#	define REMODULE__COMPILER_BARRIER() _ReadWriteBarrier()
+#	define REMODULE__LOAD_RELAXED(PTR) (*(PTR))
+#	define REMODULE__STORE_RELAXED(PTR, VALUE) (*(PTR) = (VALUE))
+#	if defined(_M_ARM64)
+// Volatile accesses have no ordering with /volatile:iso, the default on ARM64
+#		define REMODULE__STORE_RELEASE(PTR, VALUE) __stlr32((unsigned __int32 volatile*)(PTR), (VALUE))
+#		define REMODULE__LOAD_ACQUIRE(PTR) __ldar32((unsigned __int32 volatile*)(PTR))
+#		define REMODULE__LOAD_ACQUIRE_PTR(PTR) __ldar64((unsigned __int64 volatile*)(PTR))
+#		define REMODULE__FULL_FENCE() __dmb(_ARM64_BARRIER_ISH)
+#	else
+// Volatile accesses are acquires and releases with /volatile:ms, the default
+// on x86 and x64
+#		define REMODULE__STORE_RELEASE(PTR, VALUE) (*(PTR) = (VALUE))
+#		define REMODULE__LOAD_ACQUIRE(PTR) (*(PTR))
+#		define REMODULE__LOAD_ACQUIRE_PTR(PTR) (*(void* volatile const*)(PTR))
+#		define REMODULE__FULL_FENCE() _mm_mfence()
+#	endif
+#else
+#	define REMODULE__COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+#	define REMODULE__FULL_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#	define REMODULE__LOAD_RELAXED(PTR) __atomic_load_n((PTR), __ATOMIC_RELAXED)
+#	define REMODULE__STORE_RELAXED(PTR, VALUE) __atomic_store_n((PTR), (VALUE), __ATOMIC_RELAXED)
+#	define REMODULE__STORE_RELEASE(PTR, VALUE) __atomic_store_n((PTR), (VALUE), __ATOMIC_RELEASE)
+#	define REMODULE__LOAD_ACQUIRE(PTR) __atomic_load_n((PTR), __ATOMIC_ACQUIRE)
+#	define REMODULE__LOAD_ACQUIRE_PTR(PTR) __atomic_load_n((PTR), __ATOMIC_ACQUIRE)
+#endif
+
+#define REMODULE__CALL_DEPTH_MASK 0xFFFFu
+#define REMODULE__CALL_GENERATION 0x10000u
+
 #if defined(_MSC_VER)
 #	define REMODULE__SECTION_END __pragma(data_seg(pop));
 #elif defined(__APPLE__)
@@ -121,15 +515,83 @@
 #	define REMODULE__SECTION_END
 #endif
 
+/**
+ * @brief Migrate a variable whose layout changed.
+ *
+ * @param new_value The variable in the new instance.
+ *   Fields that could be transferred already hold their old value.
+ * @param new_size The size of the variable in the new instance.
+ * @param old_value The variable in the old instance.
+ * @param old_size The size of the variable in the old instance.
+ *
+ * @see REMODULE_VAR_LAYOUT
+ */
+typedef void (*remodule_migrate_fn_t)(
+	void* new_value,
+	size_t new_size,
+	const void* old_value,
+	size_t old_size
+);
+
 //! @cond remodule_internal
 
+enum {
+	// The field holds one or more pointers to relocate
+	REMODULE_FIELD_FLAG_POINTER = 1 << 0,
+};
+
+typedef struct remodule_field_info_s {
+	const char* name;
+	size_t name_length;
+	const char* type_name;
+	size_t type_name_length;
+	size_t offset;
+	size_t size;
+	unsigned flags;
+} remodule_field_info_t;
+
+enum {
+	// value_addr points to a pointer that is bound to host storage
+	REMODULE_VAR_FLAG_HOST_OWNED = 1 << 0,
+	// Not persisted, only used to relocate pointers
+	REMODULE_VAR_FLAG_RELOCATABLE = 1 << 1,
+	// Bound to host storage per thread on first access
+	REMODULE_VAR_FLAG_THREAD_LOCAL = 1 << 2,
+	// Reachable through remodule_function
+	REMODULE_VAR_FLAG_EXPORTED = 1 << 3,
+	// Has a slot in the export table
+	REMODULE_VAR_FLAG_INDEXED = 1 << 4,
+};
+
 typedef struct remodule_var_info_s {
 	const char* name;
 	size_t name_length;
 	void* value_addr;
+	void(*fn_addr)(void);
 	size_t value_size;
+	size_t value_align;
+	unsigned flags;
+	const remodule_field_info_t* fields;
+	size_t num_fields;
+	remodule_migrate_fn_t migrate;
+	size_t export_id;
 } remodule_var_info_t;
 
+#define REMODULE__FIELDS_NAME(NAME) remodule__##NAME##_fields
+#define REMODULE__TLS_NAME(NAME) remodule__##NAME##_tls
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Defined by the plugin implementation, see REMODULE_TLS
+void*
+remodule__tls_bind(const remodule_var_info_t* var);
+
+#ifdef __cplusplus
+}
+#endif
+
 #ifndef REMODULE_ASSERT
 #include <stdlib.h>
 #include <stdio.h>
@@ -178,446 +640,4512 @@ remodule_last_error(void);
 //! A reloadable module
 typedef struct remodule_s remodule_t;
 
-/**
- * @brief The operation that is being executed.
- */
-typedef enum remodule_op_e {
-	//! The module is being loaded for the first time.
-	REMODULE_OP_LOAD,
-	//! The module is being unloaded.
-	REMODULE_OP_UNLOAD,
-	//! Before a reload, this will be observed by the **old** plugin instance.
-	REMODULE_OP_BEFORE_RELOAD,
-	//! After a reload, this will be observed by the **new** plugin instance.
-	REMODULE_OP_AFTER_RELOAD,
-} remodule_op_t;
-
-#ifdef __cplusplus
-extern "C" {
-#endif
+//! A generic function pointer, see @ref remodule_function.
+typedef void (*remodule_fn_t)(void);
 
 /**
- * @brief Load a module.
+ * @brief Call through an entry point from @ref remodule_function.
  *
- * This will trigger @ref REMODULE_OP_LOAD in the module's
- * @link remodule_entry entrypoint @endlink.
+ * Example:
+ * @code{.c}
+ * typedef int (*add_fn_t)(int a, int b);
+ * remodule_fn_t volatile const* add = remodule_function(mod, "add");
  *
- * @param path Path to the module.
- * @param userdata Arbitrary userdata that will be passed to the entrypoint of
- *   the module.
+ * int sum = REMODULE_CALL(add, add_fn_t)(1, 2);
+ * @endcode
  *
- * @return The reloadable module.
+ * This is an acquire load followed by an indirect call.
+ * It pairs with the release store of a reload, so a call that lands in the
+ * new instance also sees its restored variables.
  *
- * @remarks
- *   On Windows, due to file locking, instead of loading the module directly,
- *   a temporary copy will be made.
- *   This will be loaded instead of the original module.
- *   Therefore, the directory containing the module must be writable.
- * @remarks
- *   The temporary file will be deleted once it's no longer needed.
+ * @param ENTRY The entry point.
+ * @param FN_TYPE The function pointer type of the exported function.
  */
-REMODULE_API remodule_t*
-remodule_load(const char* path, void* userdata);
+#define REMODULE_CALL(ENTRY, FN_TYPE) ((FN_TYPE)REMODULE__LOAD_ACQUIRE_PTR(ENTRY))
 
 /**
- * @brief Reload a module.
+ * @brief Counts the calls of one thread into a module.
  *
- * This will trigger @ref REMODULE_OP_BEFORE_RELOAD and
- * @ref REMODULE_OP_AFTER_RELOAD in the module's
- * @link remodule_entry entrypoint @endlink.
+ * @see remodule_register_call_counter
  */
-REMODULE_API void
-remodule_reload(remodule_t* mod);
+typedef struct remodule_call_counter_s {
+	//! Private, the nesting depth and the number of outermost calls that returned.
+	volatile uint32_t state;
+	//! Private, whether entering a call needs a fence of its own.
+	bool fenced;
+} remodule_call_counter_t;
 
 /**
- * @brief Unload a module.
+ * @brief Mark the start of a call into a module.
  *
- * This will trigger @ref REMODULE_OP_UNLOAD in the module's
- * @link remodule_entry entrypoint @endlink.
+ * Example:
+ * @code{.c}
+ * remodule_call_counter_t* counter = remodule_register_call_counter(mod);
+ *
+ * REMODULE_ENTER(counter);
+ * REMODULE_CALL(update, update_fn_t)();
+ * REMODULE_EXIT(counter);
+ * @endcode
+ *
+ * On Linux and Windows, this is a store and a compiler barrier: the fence it
+ * needs is issued on behalf of every thread by @ref remodule_drain.
+ * Elsewhere, or when the kernel does not provide `membarrier`, such as
+ * before Linux 4.3 or under a seccomp filter, it also costs a full fence.
+ *
+ * Calls can be nested.
+ *
+ * @param COUNTER A counter of the calling thread.
  */
-REMODULE_API void
-remodule_unload(remodule_t* mod);
+#define REMODULE_ENTER(COUNTER) remodule__enter(COUNTER)
 
 /**
- * @brief Get the path of a module.
+ * @brief Mark the end of a call started with @ref REMODULE_ENTER.
+ *
+ * This is a release store.
+ *
+ * @param COUNTER The same counter.
  */
-REMODULE_API const char*
-remodule_path(remodule_t* mod);
+#define REMODULE_EXIT(COUNTER) remodule__exit(COUNTER)
+
+//! @cond remodule_internal
+
+static inline void
+remodule__enter(remodule_call_counter_t* counter) {
+	// Only the owning thread writes the counter
+	REMODULE__STORE_RELAXED(&counter->state, REMODULE__LOAD_RELAXED(&counter->state) + 1u);
+	if (counter->fenced) {
+		REMODULE__FULL_FENCE();
+	} else {
+		// remodule_drain runs a full barrier on every thread
+		REMODULE__COMPILER_BARRIER();
+	}
+}
+
+static inline void
+remodule__exit(remodule_call_counter_t* counter) {
+	uint32_t state = REMODULE__LOAD_RELAXED(&counter->state) - 1u;
+	// Returning from the outermost call is what remodule_drain waits for
+	if ((state & REMODULE__CALL_DEPTH_MASK) == 0) { state += REMODULE__CALL_GENERATION; }
+	REMODULE__STORE_RELEASE(&counter->state, state);
+}
+
+//! @endcond
 
 /**
- * @brief Get the userdata associated with a module.
+ * @brief An entry of the export table.
  *
- * This is the same pointer previously passed to @ref remodule_load.
+ * @see remodule_exports
  */
-REMODULE_API void*
-remodule_userdata(remodule_t* mod);
+typedef union remodule_export_u {
+	//! Set by @ref REMODULE_EXPORT_DATA_AT.
+	void* data;
+	//! Set by @ref REMODULE_EXPORT_FN_AT.
+	remodule_fn_t fn;
+} remodule_export_t;
 
-#ifdef DOXYGEN
+/**
+ * @brief Get a function from an export table.
+ *
+ * Example:
+ * @code{.c}
+ * typedef void (*update_fn_t)(void);
+ * const remodule_export_t* exports = remodule_exports(mod, NULL);
+ *
+ * REMODULE_EXPORTED_FN(exports, PLUGIN_EXPORT_UPDATE, update_fn_t)();
+ * @endcode
+ *
+ * @param EXPORTS The table from @ref remodule_exports.
+ * @param ID The index given to @ref REMODULE_EXPORT_FN_AT.
+ * @param FN_TYPE The function pointer type of the exported function.
+ */
+#define REMODULE_EXPORTED_FN(EXPORTS, ID, FN_TYPE) \
+	((FN_TYPE)REMODULE__LOAD_ACQUIRE_PTR(&(EXPORTS)[ID].fn))
 
 /**
- * @brief A plugin **must** define this function.
+ * @brief Get a variable from an export table.
  *
- * This will be called at various points during the plugin's lifecycle.
+ * @param EXPORTS The table from @ref remodule_exports.
+ * @param ID The index given to @ref REMODULE_EXPORT_DATA_AT.
+ * @param TYPE The type of the exported variable.
+ * @return A pointer to the variable.
+ */
+#define REMODULE_EXPORTED_DATA(EXPORTS, ID, TYPE) \
+	((TYPE*)REMODULE__LOAD_ACQUIRE_PTR(&(EXPORTS)[ID].data))
+
+/**
+ * @brief The operation that is being executed.
+ */
+typedef enum remodule_op_e {
+	//! The module is being loaded for the first time.
+	REMODULE_OP_LOAD,
+	//! The module is being unloaded.
+	REMODULE_OP_UNLOAD,
+	//! Before a reload, this will be observed by the **old** plugin instance.
+	REMODULE_OP_BEFORE_RELOAD,
+	//! After a reload, this will be observed by the **new** plugin instance.
+	REMODULE_OP_AFTER_RELOAD,
+} remodule_op_t;
+
+/**
+ * @brief The state of a background reload.
  *
- * @param op The operation currently being executed.
- * @param userdata The userdata passed from the host in @ref remodule_load.
- *   This always points to the same object between reloads.
+ * @see remodule_reload_begin
  */
-REMODULE_API void
-remodule_entry(remodule_op_t op, void* userdata);
+typedef enum remodule_reload_status_e {
+	//! No background reload is in progress.
+	REMODULE_RELOAD_IDLE,
+	//! The new instance is still being loaded.
+	REMODULE_RELOAD_PENDING,
+	//! The new instance is loaded and can be committed.
+	REMODULE_RELOAD_READY,
+	//! The new instance could not be loaded.
+	REMODULE_RELOAD_FAILED,
+	//! The module is identical to the loaded instance so nothing was loaded.
+	REMODULE_RELOAD_UNCHANGED,
+} remodule_reload_status_t;
+
+/**
+ * @brief A phase of a reload.
+ *
+ * @see remodule_stats_t
+ */
+typedef enum remodule_phase_e {
+	//! @ref REMODULE_OP_BEFORE_RELOAD in the old instance.
+	REMODULE_PHASE_BEFORE_RELOAD,
+	//! Saving persisted variables of the old instance.
+	REMODULE_PHASE_SNAPSHOT,
+	//! Closing the old instance.
+	REMODULE_PHASE_CLOSE,
+	//! Loading the new instance.
+	REMODULE_PHASE_OPEN,
+	//! Restoring persisted variables into the new instance.
+	REMODULE_PHASE_RESTORE,
+	//! @ref REMODULE_OP_AFTER_RELOAD in the new instance.
+	REMODULE_PHASE_AFTER_RELOAD,
+
+	//! The number of phases.
+	REMODULE_PHASE_COUNT,
+} remodule_phase_t;
+
+//! The number of buckets in a @ref remodule_timing_t histogram.
+#define REMODULE_HISTOGRAM_BUCKETS 32
+
+/**
+ * @brief Timing of a repeated operation.
+ */
+typedef struct remodule_timing_s {
+	//! Duration of the last run in nanoseconds.
+	uint64_t last_ns;
+	//! Longest duration in nanoseconds.
+	uint64_t max_ns;
+	//! Sum of all durations in nanoseconds.
+	uint64_t total_ns;
+	/**
+	 * @brief Number of runs by duration.
+	 *
+	 * Bucket 0 counts runs shorter than 1 microsecond.
+	 * Bucket `i` counts runs that took [2^(i-1), 2^i) microseconds.
+	 * The last bucket also counts anything longer.
+	 */
+	uint32_t histogram[REMODULE_HISTOGRAM_BUCKETS];
+} remodule_timing_t;
+
+/**
+ * @brief Memory usage of the allocators of a module.
+ *
+ * Reserved bytes are what was requested from the system.
+ * Used bytes are what was requested by the plugin.
+ */
+typedef struct remodule_memory_usage_s {
+	//! Bytes reserved for @ref remodule_arena_alloc.
+	size_t arena_reserved;
+	//! Bytes allocated with @ref remodule_arena_alloc.
+	size_t arena_used;
+	//! Bytes reserved for @ref remodule_pool_alloc.
+	size_t pool_reserved;
+	//! Bytes allocated with @ref remodule_pool_alloc and not yet freed, rounded up to their size class.
+	size_t pool_used;
+	//! Bytes reserved for @ref remodule_frame_alloc.
+	size_t frame_reserved;
+	//! Bytes allocated with @ref remodule_frame_alloc since the last @ref remodule_frame_reset.
+	size_t frame_used;
+	//! Highest value of @ref remodule_memory_usage_t::frame_used.
+	size_t frame_peak;
+	//! Bytes of @ref REMODULE_TLS_VAR storage across all threads.
+	size_t thread_local_reserved;
+} remodule_memory_usage_t;
+
+/**
+ * @brief Statistics of a module.
+ *
+ * @see remodule_stats
+ */
+typedef struct remodule_stats_s {
+	//! Number of successful reloads.
+	uint32_t reload_count;
+	//! Number of reloads skipped because the module was identical to the loaded instance.
+	uint32_t unchanged_count;
+	//! Duration of @ref remodule_load in nanoseconds.
+	uint64_t load_ns;
+	//! Duration of @ref remodule_unload in nanoseconds, only set during @ref REMODULE_OP_UNLOAD events.
+	uint64_t unload_ns;
+	/**
+	 * @brief Duration of whole reloads as seen by the reloading thread.
+	 *
+	 * For @ref remodule_reload_commit and @ref remodule_reload_many, this
+	 * only covers the swap, not the background load.
+	 */
+	remodule_timing_t reload;
+	//! Duration of each reload phase.
+	remodule_timing_t phases[REMODULE_PHASE_COUNT];
+
+	//! Number of bytes copied out of the old instance during the last reload.
+	size_t snapshot_bytes;
+	//! Number of variables restored during the last reload.
+	size_t num_vars_matched;
+	//! Number of variables of the old instance missing from the new one during the last reload.
+	size_t num_vars_dropped;
+	//! Number of variables that changed size and were reset during the last reload.
+	size_t num_vars_size_mismatched;
+	//! Number of restored variables that went through their layout or migration callback during the last reload.
+	size_t num_vars_migrated;
+	//! Number of pointers updated to point into the new instance during the last reload.
+	size_t num_pointers_relocated;
+	//! Number of pointers set to `NULL` because their target is gone during the last reload.
+	size_t num_pointers_unresolved;
+
+	//! Current memory usage of the module's allocators.
+	remodule_memory_usage_t memory;
+
+	//! Number of old instances still open because readers may be using them.
+	size_t num_retired_instances;
+} remodule_stats_t;
+
+/**
+ * @brief A thread calling into a module concurrently with reloads.
+ *
+ * @see remodule_read_lock
+ */
+typedef struct remodule_reader_s remodule_reader_t;
+
+/**
+ * @brief A callback to receive statistics.
+ *
+ * @param mod The module.
+ * @param op @ref REMODULE_OP_LOAD, @ref REMODULE_OP_AFTER_RELOAD or
+ *   @ref REMODULE_OP_UNLOAD depending on what just finished.
+ *   For @ref REMODULE_OP_UNLOAD, this is called right before the module is freed.
+ * @param stats The updated statistics.
+ * @param userdata The userdata given to @ref remodule_set_stats_hook.
+ */
+typedef void (*remodule_stats_hook_t)(
+	remodule_t* mod,
+	remodule_op_t op,
+	const remodule_stats_t* stats,
+	void* userdata
+);
+
+/**
+ * @brief Options for @ref remodule_load_ex.
+ *
+ * A zero-initialized struct gives the same behaviour as @ref remodule_load.
+ */
+typedef struct remodule_load_options_s {
+	/**
+	 * @brief Path to a snapshot file for persisted variables.
+	 *
+	 * If it is set and the file exists, variables that are in the snapshot
+	 * with the same size are restored before @ref REMODULE_OP_LOAD.
+	 * The snapshot is written on @ref remodule_unload and
+	 * @ref remodule_save_snapshot.
+	 *
+	 * This lets persisted state survive a restart of the host.
+	 * Only variables that hold no pointers are meaningful in a new process.
+	 */
+	const char* snapshot_path;
+
+	/**
+	 * @brief Reload even when the module is unchanged.
+	 *
+	 * By default, the ELF build id of the module, or a hash of its content
+	 * when it has none, is recorded on every load.
+	 * A reload of an identical module returns early without triggering any
+	 * callback.
+	 */
+	bool reload_unchanged;
+
+	/**
+	 * @brief Load a private instance of the module.
+	 *
+	 * Loading the same path twice normally returns the same loaded image, so
+	 * both modules share globals and @ref REMODULE_VAR.
+	 * An instanced load maps a private copy of the module instead, like a
+	 * reload does, so that every instance has its own data segment, its own
+	 * exports and its own state transfer.
+	 * This allows, for example, one instance per thread without sharing
+	 * any plugin global between them.
+	 *
+	 * The path is opened as a file, it is not searched for like `dlopen`
+	 * does.
+	 *
+	 * @remarks
+	 *   Each instance costs its own copy of the module's code and data.
+	 *   The copy is made like a reload does, see @ref remodule_reload.
+	 */
+	bool instanced;
+
+	/**
+	 * @brief Keep private copies of the module in memory.
+	 *
+	 * On Linux, reloads and instanced loads copy the module into an
+	 * anonymous file from `memfd_create` instead of a hidden file next to
+	 * the module, so the directory of the module is left alone.
+	 * Elsewhere, this has no effect.
+	 *
+	 * @remarks
+	 *   The copy is loaded from `/proc/self/fd`.
+	 *   `$ORIGIN` expands to that directory, so dependencies that are found
+	 *   through an rpath relative to the module fail to load.
+	 *   Debuggers and profilers cannot open the file either, so they do not
+	 *   see the symbols of the module.
+	 */
+	bool in_memory;
+} remodule_load_options_t;
 
 #ifdef __cplusplus
-}
+extern "C" {
 #endif
 
-#endif
+/**
+ * @brief Load a module.
+ *
+ * This will trigger @ref REMODULE_OP_LOAD in the module's
+ * @link remodule_entry entrypoint @endlink.
+ *
+ * @param path Path to the module.
+ * @param userdata Arbitrary userdata that will be passed to the entrypoint of
+ *   the module.
+ *
+ * @return The reloadable module.
+ *
+ * @remarks
+ *   On Windows, due to file locking, instead of loading the module directly,
+ *   a temporary copy will be made.
+ *   This will be loaded instead of the original module.
+ *   Elsewhere, reloads do the same, see @ref remodule_reload.
+ *   Therefore, the directory containing the module must be writable.
+ * @remarks
+ *   The temporary file will be deleted once it's no longer needed.
+ * @remarks
+ *   Elsewhere, the first instance maps the module file itself so that other
+ *   loads of the same path share it.
+ *   Overwriting that file in place changes the code and data of the running
+ *   instance and can crash it, so builds must replace it instead, for
+ *   example by writing elsewhere and renaming over it.
+ *   An @link remodule_load_options_t::instanced instanced @endlink load maps
+ *   a copy from the start.
+ */
+REMODULE_API remodule_t*
+remodule_load(const char* path, void* userdata);
 
-#endif
+/**
+ * @brief Load a module with extra options.
+ *
+ * @param path Path to the module.
+ * @param userdata Arbitrary userdata that will be passed to the entrypoint of
+ *   the module.
+ * @param options Extra options, `NULL` for the defaults.
+ *
+ * @see remodule_load
+ */
+REMODULE_API remodule_t*
+remodule_load_ex(const char* path, void* userdata, const remodule_load_options_t* options);
 
-#if (defined(REMODULE_PLUGIN_IMPLEMENTATION) || defined(REMODULE_HOST_IMPLEMENTATION)) && !defined(REMODULE_INTERNAL)
-#define REMODULE_INTERNAL
+/**
+ * @brief Reload a module.
+ *
+ * This will trigger @ref REMODULE_OP_BEFORE_RELOAD and
+ * @ref REMODULE_OP_AFTER_RELOAD in the module's
+ * @link remodule_entry entrypoint @endlink.
+ *
+ * @remarks
+ *   The new instance is always loaded from a private copy of the module so
+ *   that a lingering reference to the old instance cannot make the loader
+ *   return it again, and so that a build in progress cannot be mapped.
+ *   The copy is a hidden file in the directory of the module, named
+ *   `.<name>.<pid>.XXXXXX`, so that `$ORIGIN` and debuggers work as usual.
+ *   Therefore, the directory containing the module must be writable.
+ *   It is deleted when the instance is closed.
+ *   Copies left behind by a process that died are deleted the next time
+ *   the module is loaded.
+ *   See @ref remodule_load_options_t::in_memory to keep it in memory instead.
+ *
+ * @remarks
+ *   If the module has @link remodule_register_reader readers @endlink, this
+ *   loads the new instance like @ref remodule_reload_staged does.
+ *   Failing to load is still fatal.
+ *
+ * @return Whether the module was reloaded.
+ *   This is false if the module is identical to the loaded instance, see
+ *   @ref remodule_load_options_t::reload_unchanged.
+ */
+REMODULE_API bool
+remodule_reload(remodule_t* mod);
 
-#define REMODULE_INFO_SYMBOL remodule__plugin_info
-#define REMODULE_INFO_SYMBOL_STR REMODULE_STRINGIFY(REMODULE_INFO_SYMBOL)
-#define REMODULE_STRINGIFY(X) REMODULE_STRINGIFY2(X)
-#define REMODULE_STRINGIFY2(X) #X
+/**
+ * @brief Reload a module, loading the new instance before the old one is closed.
+ *
+ * The new instance is loaded from a private copy of the module, side by side
+ * with the old instance.
+ * Only once it has been loaded successfully are
+ * @ref REMODULE_OP_BEFORE_RELOAD and @ref REMODULE_OP_AFTER_RELOAD triggered.
+ * State is copied directly from the old instance to the new one.
+ *
+ * @return Whether the module was reloaded.
+ *   On failure, the old instance is left untouched and
+ *   @ref remodule_reload_error describes the problem.
+ *   If the module is identical to the loaded instance, nothing is loaded and
+ *   @ref remodule_reload_error says so.
+ *
+ * @remarks
+ *   Static initializers of the new instance run while the old instance is
+ *   still loaded.
+ */
+REMODULE_API bool
+remodule_reload_staged(remodule_t* mod);
 
-typedef struct remodule_plugin_info_s {
-	const remodule_var_info_t* const* var_info_begin;
-	const remodule_var_info_t* const* var_info_end;
-	void(*entry)(remodule_op_t op, void* userdata);
-} remodule_plugin_info_t;
+/**
+ * @brief Start loading the new instance of a module on a background thread.
+ *
+ * This does the same work as the loading half of @ref remodule_reload_staged.
+ * The old instance keeps running until @ref remodule_reload_commit is called.
+ *
+ * @return Whether a background reload was started.
+ *   This fails if one is already in progress.
+ *
+ * @remarks
+ *   Static initializers of the new instance run on the background thread.
+ */
+REMODULE_API bool
+remodule_reload_begin(remodule_t* mod);
 
-#endif
+/**
+ * @brief Check on a background reload without blocking.
+ */
+REMODULE_API remodule_reload_status_t
+remodule_reload_poll(remodule_t* mod);
 
-#ifdef REMODULE_PLUGIN_IMPLEMENTATION
+/**
+ * @brief Finish a background reload.
+ *
+ * If the new instance is still being loaded, this waits for it.
+ * Then, @ref REMODULE_OP_BEFORE_RELOAD and @ref REMODULE_OP_AFTER_RELOAD
+ * are triggered and state is transferred on the calling thread.
+ *
+ * @return Whether the module was reloaded.
+ *   On failure, the old instance is left untouched and
+ *   @ref remodule_reload_error describes the problem.
+ *   This is also false if the module was unchanged.
+ */
+REMODULE_API bool
+remodule_reload_commit(remodule_t* mod);
 
-#if defined(_WIN32)
-#	define REMODULE_EXPORT __declspec(dllexport)
-#else
-#	define REMODULE_EXPORT __attribute__((visibility("default")))
-#endif
+/**
+ * @brief Reload many modules at once.
+ *
+ * The new instances of all modules are loaded in parallel, like
+ * @ref remodule_reload_begin does for a single module.
+ * Once every module has been loaded, state transfer and lifecycle callbacks
+ * are run for each of them in order on the calling thread.
+ *
+ * @param mods The modules to reload.
+ * @param num_mods The number of modules.
+ * @param num_threads The number of threads to load with, including the
+ *   calling thread.
+ *   If this is 0 or less, the number of CPUs is used.
+ * @return The number of modules that were reloaded.
+ *   A module that failed to load keeps its old instance and
+ *   @ref remodule_reload_error describes the problem.
+ *   Modules with a background reload in progress and unchanged modules are
+ *   skipped.
+ *
+ * @remarks
+ *   glibc holds a global lock for the duration of `dlopen`, static
+ *   initializers included.
+ *   There, only snapshotting the module files runs in parallel.
+ */
+REMODULE_API size_t
+remodule_reload_many(remodule_t** mods, size_t num_mods, int num_threads);
 
-#if defined(_MSC_VER)
-__pragma(section("remodule$begin", read));
-__pragma(section("remodule$data", read));
-__pragma(section("remodule$end", read));
-__declspec(allocate("remodule$begin")) extern const remodule_var_info_t* const remodule_var_info_begin = NULL;
-__declspec(allocate("remodule$end")) extern const remodule_var_info_t* const remodule_var_info_end = NULL;
-#elif defined(__APPLE__)
-extern const remodule_var_info_t* const __start_remodule __asm("section$start$__DATA$remodule");
-extern const remodule_var_info_t* const __stop_remodule __asm("section$end$__DATA$remodule");
-__attribute__((used, section("__DATA,remodule"))) const remodule_var_info_t* const remodule__dummy = NULL;
-#elif defined(__unix__)
-extern const remodule_var_info_t* const __start_remodule;
-extern const remodule_var_info_t* const __stop_remodule;
-__attribute__((used, section("remodule"))) const remodule_var_info_t* const remodule__dummy = NULL;
-#endif
+/**
+ * @brief Get the reason the last background or staged reload failed.
+ */
+REMODULE_API const char*
+remodule_reload_error(remodule_t* mod);
+
+/**
+ * @brief Unload a module.
+ *
+ * This will trigger @ref REMODULE_OP_UNLOAD in the module's
+ * @link remodule_entry entrypoint @endlink.
+ */
+REMODULE_API void
+remodule_unload(remodule_t* mod);
+
+/**
+ * @brief Write the persisted variables of a module to its snapshot file.
+ *
+ * This is done automatically on @ref remodule_unload.
+ * Call this periodically to also survive a crash of the host.
+ *
+ * The file is replaced atomically.
+ *
+ * @return Whether the snapshot was written.
+ *   This fails if the module was not loaded with
+ *   @ref remodule_load_options_t::snapshot_path.
+ *
+ * @remarks
+ *   Snapshots are only compatible between builds for the same architecture.
+ *   Large page-aligned variables are restored by mapping the file instead
+ *   of copying it.
+ */
+REMODULE_API bool
+remodule_save_snapshot(remodule_t* mod);
+
+/**
+ * @brief Get the statistics of a module.
+ */
+REMODULE_API const remodule_stats_t*
+remodule_stats(remodule_t* mod);
+
+/**
+ * @brief Set a callback that is called whenever statistics are updated.
+ *
+ * This applies to all modules.
+ *
+ * @param hook The callback, `NULL` to disable.
+ * @param userdata Arbitrary userdata passed to the callback.
+ */
+REMODULE_API void
+remodule_set_stats_hook(remodule_stats_hook_t hook, void* userdata);
+
+/**
+ * @brief Get the path of a module.
+ */
+REMODULE_API const char*
+remodule_path(remodule_t* mod);
+
+/**
+ * @brief Get the userdata associated with a module.
+ *
+ * This is the same pointer previously passed to @ref remodule_load.
+ */
+REMODULE_API void*
+remodule_userdata(remodule_t* mod);
+
+/**
+ * @brief Allocate memory that lives as long as the module.
+ *
+ * The memory survives reloads and is released all at once on
+ * @ref remodule_unload.
+ * It cannot be freed individually.
+ *
+ * @param mod The module, in a plugin this is @ref remodule_self.
+ * @param size Size of the allocation.
+ * @param align Alignment of the allocation, a power of two.
+ *   0 means the alignment of `max_align_t`.
+ * @return Zero-initialized memory or `NULL` if it could not be allocated.
+ *
+ * @remarks
+ *   Allocators of a module must not be used from several threads at the
+ *   same time.
+ */
+REMODULE_API void*
+remodule_arena_alloc(remodule_t* mod, size_t size, size_t align);
+
+/**
+ * @brief Allocate memory from the size-class pools of a module.
+ *
+ * Sizes up to 4096 bytes are rounded up to a power of two and recycled
+ * through a free list.
+ * Larger ones are allocated individually.
+ * Like @ref remodule_arena_alloc, the memory survives reloads and anything
+ * not freed is released on @ref remodule_unload.
+ *
+ * @param mod The module, in a plugin this is @ref remodule_self.
+ * @param size Size of the allocation.
+ * @return Memory aligned for `max_align_t` or `NULL` if it could not be
+ *   allocated.
+ *   It is not zero-initialized.
+ */
+REMODULE_API void*
+remodule_pool_alloc(remodule_t* mod, size_t size);
+
+/**
+ * @brief Return memory to the pools of a module.
+ *
+ * @param mod The module, in a plugin this is @ref remodule_self.
+ * @param ptr Memory from @ref remodule_pool_alloc, can be `NULL`.
+ * @param size The size that was passed to @ref remodule_pool_alloc.
+ */
+REMODULE_API void
+remodule_pool_free(remodule_t* mod, void* ptr, size_t size);
+
+/**
+ * @brief Allocate scratch memory from the bump allocator of a module.
+ *
+ * This is meant for per-frame or per-request data.
+ * Everything is released at once with @ref remodule_frame_reset.
+ *
+ * @param mod The module, in a plugin this is @ref remodule_self.
+ * @param size Size of the allocation.
+ * @param align Alignment of the allocation, a power of two.
+ *   0 means the alignment of `max_align_t`.
+ * @return Memory that is not zero-initialized or `NULL` if it could not be
+ *   allocated.
+ */
+REMODULE_API void*
+remodule_frame_alloc(remodule_t* mod, size_t size, size_t align);
+
+/**
+ * @brief Release all memory from @ref remodule_frame_alloc.
+ *
+ * The reserved memory is kept for the next frame.
+ * If the last frame did not fit in one block, it is replaced with a single
+ * block large enough for it.
+ */
+REMODULE_API void
+remodule_frame_reset(remodule_t* mod);
+
+/**
+ * @brief Publish the interface of a module to readers.
+ *
+ * A plugin calls this with its table of function pointers during
+ * @ref REMODULE_OP_LOAD and @ref REMODULE_OP_AFTER_RELOAD.
+ * The pointer is swapped atomically and returned by @ref remodule_read_lock.
+ *
+ * @param mod The module, in a plugin this is @ref remodule_self.
+ * @param interface The new interface.
+ *   It must live in the new instance or in memory that outlives it.
+ */
+REMODULE_API void
+remodule_publish(remodule_t* mod, void* interface);
+
+/**
+ * @brief Register the calling thread as a reader of a module.
+ *
+ * Each thread that calls into the module while it is being reloaded from
+ * another thread needs its own reader.
+ * Once a module has readers, reloads no longer close the old instance right
+ * away.
+ * It is retired until every reader has left the read sections that might
+ * have seen it.
+ *
+ * @return A reader, valid until @ref remodule_unregister_reader or
+ *   @ref remodule_unload.
+ *
+ * @remarks
+ *   Register readers before starting reloads that may overlap with them.
+ *
+ * @remarks
+ *   State transfer is not consistent with readers that write persisted
+ *   variables: they keep running the old instance while its variables are
+ *   copied, and whatever they write after @ref REMODULE_OP_BEFORE_RELOAD is
+ *   lost.
+ *   Keep such state in @ref REMODULE_HOST_VAR, which both instances share,
+ *   or stop the writers with @ref remodule_drain before reloading.
+ */
+REMODULE_API remodule_reader_t*
+remodule_register_reader(remodule_t* mod);
+
+/**
+ * @brief Unregister a reader so that it can be reused by another thread.
+ *
+ * It must not be in a read section.
+ */
+REMODULE_API void
+remodule_unregister_reader(remodule_reader_t* reader);
+
+/**
+ * @brief Enter a read section.
+ *
+ * Until @ref remodule_read_unlock, the instance that published the returned
+ * interface stays open, even if the module is reloaded in the meantime.
+ *
+ * This is wait-free: it is a few atomic operations on memory owned by the
+ * reader and never waits for a reload.
+ *
+ * Example:
+ * @code{.c}
+ * plugin_interface_t* interface = remodule_read_lock(reader);
+ * interface->update(interface->plugin_data);
+ * remodule_read_unlock(reader);
+ * @endcode
+ *
+ * @return The interface given to @ref remodule_publish, can be `NULL`.
+ *
+ * @remarks
+ *   Read sections cannot be nested.
+ *   A read section should be short, it holds back the release of old
+ *   instances.
+ */
+REMODULE_API void*
+remodule_read_lock(remodule_reader_t* reader);
+
+/**
+ * @brief Leave a read section.
+ */
+REMODULE_API void
+remodule_read_unlock(remodule_reader_t* reader);
+
+/**
+ * @brief Close the retired instances that no reader can be using anymore.
+ *
+ * This is done automatically on every reload.
+ * Call it periodically, between reloads, to release old instances sooner.
+ *
+ * It updates the retired instances without a lock, so it must be called
+ * from the thread that reloads the module, never while a reload runs.
+ *
+ * @return The number of instances closed.
+ */
+REMODULE_API size_t
+remodule_reclaim(remodule_t* mod);
+
+/**
+ * @brief Wait for all current read sections to end, then close all retired instances.
+ *
+ * Like @ref remodule_reclaim, this must be called from the thread that
+ * reloads the module.
+ */
+REMODULE_API void
+remodule_synchronize(remodule_t* mod);
+
+/**
+ * @brief Register a counter for the calls of the calling thread into a module.
+ *
+ * Each thread that brackets its calls with @ref REMODULE_ENTER and
+ * @ref REMODULE_EXIT needs its own counter.
+ *
+ * @return A counter, valid until @ref remodule_unregister_call_counter or
+ *   @ref remodule_unload.
+ */
+REMODULE_API remodule_call_counter_t*
+remodule_register_call_counter(remodule_t* mod);
+
+/**
+ * @brief Unregister a counter so that it can be reused by another thread.
+ *
+ * It must not be in a call.
+ */
+REMODULE_API void
+remodule_unregister_call_counter(remodule_call_counter_t* counter);
+
+/**
+ * @brief Wait for the calls in flight to return.
+ *
+ * Every call started with @ref REMODULE_ENTER before this is called is waited
+ * for.
+ * Calls started afterwards are not, so new calls must be stopped first, for
+ * example before @ref remodule_reload.
+ *
+ * A host can stop them with a flag of its own, stored with a sequentially
+ * consistent store before this is called.
+ * Callers must check it after @ref REMODULE_ENTER, not before: a caller that
+ * entered before this function's barrier is waited for, and one that
+ * entered after it sees the flag.
+ *
+ * Example:
+ * @code{.c}
+ * // On every calling thread
+ * REMODULE_ENTER(counter);
+ * if (!atomic_load(&paused)) {
+ *     REMODULE_CALL(update, update_fn_t)();
+ * }
+ * REMODULE_EXIT(counter);
+ *
+ * // On the reloading thread
+ * atomic_store(&paused, true);
+ * if (remodule_drain(mod, 100)) {
+ *     remodule_reload(mod);
+ * }
+ * atomic_store(&paused, false);
+ * @endcode
+ *
+ * @param mod The module.
+ * @param timeout_ms How long to wait in milliseconds.
+ *   A negative value waits forever.
+ * @return Whether all those calls returned in time.
+ *
+ * @remarks
+ *   On Linux, this runs `membarrier` and on Windows,
+ *   `FlushProcessWriteBuffers`, which interrupt every running thread of the
+ *   process.
+ *   Without them, @ref REMODULE_ENTER fences on its own and this only
+ *   waits.
+ */
+REMODULE_API bool
+remodule_drain(remodule_t* mod, int timeout_ms);
+
+/**
+ * @brief Get a stable entry point to a function exported with @ref REMODULE_EXPORT_FN.
+ *
+ * Every reload retargets it to the function of the same name in the new
+ * instance, so it never needs to be looked up again.
+ *
+ * @param mod The module.
+ * @param name Name of the function.
+ * @return A pointer to the current address of the function, valid until
+ *   @ref remodule_unload.
+ *   Its target is `NULL` while the current instance does not export the
+ *   function.
+ *   Calling the same name again returns the same pointer.
+ *
+ * @remarks
+ *   Updating the target is a single pointer-sized release store, made after
+ *   @ref REMODULE_OP_AFTER_RELOAD returns in the new instance, like
+ *   @ref remodule_publish is from inside it.
+ *   Until then, calls still go to the old instance when it is kept alive for
+ *   readers, see @ref remodule_reload_staged.
+ *   A @ref remodule_reload without readers closes the old instance first,
+ *   so the target is `NULL` for the whole reload: calls must be drained with
+ *   @ref remodule_drain.
+ *   Threads that may still run code of an old instance after a reload should
+ *   call from a @ref remodule_read_lock section.
+ *
+ * @see REMODULE_CALL
+ */
+REMODULE_API remodule_fn_t volatile const*
+remodule_function(remodule_t* mod, const char* name);
+
+/**
+ * @brief Get the export table of a module.
+ *
+ * Entry `i` holds what the current instance exported with
+ * @ref REMODULE_EXPORT_FN_AT or @ref REMODULE_EXPORT_DATA_AT at index `i`.
+ * Other entries are `NULL`.
+ *
+ * The table is filled from the `remodule` section while the plugin is
+ * scanned, without looking up any symbol, and updated in place on reload,
+ * after @ref REMODULE_OP_AFTER_RELOAD returns in the new instance.
+ * Every entry is written atomically.
+ * While the old instance is kept alive for readers, as with
+ * @ref remodule_reload_staged, other threads may read the table with
+ * @ref REMODULE_EXPORTED_FN or @ref REMODULE_EXPORTED_DATA during a reload.
+ * A @ref remodule_reload without readers closes the old instance first and
+ * clears every entry until the new one is bound: calls must be drained with
+ * @ref remodule_drain.
+ *
+ * A plugin exporting two symbols at one index fails to load or reload.
+ *
+ * @param mod The module.
+ * @param num_exports If not `NULL`, receives the number of entries: one
+ *   past the highest index exported.
+ * @return The table.
+ *   It only moves when a reload exports a higher index than before.
+ *   Tables returned before stay valid and keep being updated for the
+ *   entries they have until @ref remodule_unload.
+ */
+REMODULE_API const remodule_export_t*
+remodule_exports(remodule_t* mod, size_t* num_exports);
+
+/**
+ * @brief Get the module of the calling plugin.
+ *
+ * This is only available in plugins and is set before
+ * @ref REMODULE_OP_LOAD.
+ * It always returns the same pointer between reloads.
+ */
+REMODULE_API remodule_t*
+remodule_self(void);
+
+#ifdef DOXYGEN
+
+/**
+ * @brief A plugin **must** define this function.
+ *
+ * This will be called at various points during the plugin's lifecycle.
+ *
+ * @param op The operation currently being executed.
+ * @param userdata The userdata passed from the host in @ref remodule_load.
+ *   This always points to the same object between reloads.
+ */
+REMODULE_API void
+remodule_entry(remodule_op_t op, void* userdata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+#endif
+
+#if (defined(REMODULE_PLUGIN_IMPLEMENTATION) || defined(REMODULE_HOST_IMPLEMENTATION)) && !defined(REMODULE_INTERNAL)
+#define REMODULE_INTERNAL
+
+#define REMODULE_INFO_SYMBOL remodule__plugin_info
+#define REMODULE_INFO_SYMBOL_STR REMODULE_STRINGIFY(REMODULE_INFO_SYMBOL)
+#define REMODULE_STRINGIFY(X) REMODULE_STRINGIFY2(X)
+#define REMODULE_STRINGIFY2(X) #X
+
+// Host functions that plugins call through their info struct
+typedef struct remodule_host_api_s {
+	void* (*arena_alloc)(remodule_t* mod, size_t size, size_t align);
+	void* (*pool_alloc)(remodule_t* mod, size_t size);
+	void (*pool_free)(remodule_t* mod, void* ptr, size_t size);
+	void* (*frame_alloc)(remodule_t* mod, size_t size, size_t align);
+	void (*frame_reset)(remodule_t* mod);
+	void (*publish)(remodule_t* mod, void* interface);
+	void* (*tls_bind)(remodule_t* mod, const remodule_var_info_t* var);
+} remodule_host_api_t;
+
+typedef struct remodule_plugin_info_s {
+	const remodule_var_info_t* const* var_info_begin;
+	const remodule_var_info_t* const* var_info_end;
+	void(*entry)(remodule_op_t op, void* userdata);
+	// Filled in by the host
+	remodule_t* mod;
+	const remodule_host_api_t* host_api;
+} remodule_plugin_info_t;
+
+#endif
+
+#ifdef REMODULE_PLUGIN_IMPLEMENTATION
+
+#if defined(_WIN32)
+#	define REMODULE_EXPORT __declspec(dllexport)
+#else
+#	define REMODULE_EXPORT __attribute__((visibility("default")))
+#endif
+
+#if defined(_MSC_VER)
+__pragma(section("remodule$begin", read));
+__pragma(section("remodule$data", read));
+__pragma(section("remodule$end", read));
+__declspec(allocate("remodule$begin")) extern const remodule_var_info_t* const remodule_var_info_begin = NULL;
+__declspec(allocate("remodule$end")) extern const remodule_var_info_t* const remodule_var_info_end = NULL;
+#elif defined(__APPLE__)
+extern const remodule_var_info_t* const __start_remodule __asm("section$start$__DATA$remodule");
+extern const remodule_var_info_t* const __stop_remodule __asm("section$end$__DATA$remodule");
+__attribute__((used, section("__DATA,remodule"))) const remodule_var_info_t* const remodule__dummy = NULL;
+#elif defined(__unix__)
+extern const remodule_var_info_t* const __start_remodule;
+extern const remodule_var_info_t* const __stop_remodule;
+__attribute__((used, section("remodule"))) const remodule_var_info_t* const remodule__dummy = NULL;
+#endif
+
+#if defined(_MSC_VER)
+#	define REMODULE_VAR_INFO_BEGIN (&remodule_var_info_begin + 1)
+#	define REMODULE_VAR_INFO_END (&remodule_var_info_end)
+#elif defined(__unix__) || defined(__APPLE__)
+#	define REMODULE_VAR_INFO_BEGIN (&__start_remodule)
+#	define REMODULE_VAR_INFO_END (&__stop_remodule)
+#endif
+
+void
+remodule_entry(remodule_op_t op, void* userdata);
+
+REMODULE_EXPORT remodule_plugin_info_t REMODULE_INFO_SYMBOL = {
+	.entry = &remodule_entry,
+	.var_info_begin = REMODULE_VAR_INFO_BEGIN,
+	.var_info_end = REMODULE_VAR_INFO_END,
+};
+
+void*
+remodule__tls_bind(const remodule_var_info_t* var) {
+	return REMODULE_INFO_SYMBOL.host_api->tls_bind(REMODULE_INFO_SYMBOL.mod, var);
+}
+
+#ifndef REMODULE_HOST_IMPLEMENTATION
+
+remodule_t*
+remodule_self(void) {
+	return REMODULE_INFO_SYMBOL.mod;
+}
+
+void*
+remodule_arena_alloc(remodule_t* mod, size_t size, size_t align) {
+	return REMODULE_INFO_SYMBOL.host_api->arena_alloc(mod, size, align);
+}
+
+void*
+remodule_pool_alloc(remodule_t* mod, size_t size) {
+	return REMODULE_INFO_SYMBOL.host_api->pool_alloc(mod, size);
+}
+
+void
+remodule_pool_free(remodule_t* mod, void* ptr, size_t size) {
+	REMODULE_INFO_SYMBOL.host_api->pool_free(mod, ptr, size);
+}
+
+void*
+remodule_frame_alloc(remodule_t* mod, size_t size, size_t align) {
+	return REMODULE_INFO_SYMBOL.host_api->frame_alloc(mod, size, align);
+}
+
+void
+remodule_frame_reset(remodule_t* mod) {
+	REMODULE_INFO_SYMBOL.host_api->frame_reset(mod);
+}
+
+void
+remodule_publish(remodule_t* mod, void* interface) {
+	REMODULE_INFO_SYMBOL.host_api->publish(mod, interface);
+}
+
+#endif
+
+#endif
+
+#if defined(REMODULE_HOST_IMPLEMENTATION) && !defined(REMODULE_HOST_IMPLEMENTATION_GUARD)
+#define REMODULE_HOST_IMPLEMENTATION_GUARD
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <malloc.h>
+
+#define REMODULE_PATH_MAX MAX_PATH
+
+typedef struct remodule_dynlib_info_s {
+	HMODULE handle;
+	char watch_path[];
+} remodule_dynlib_info_t;
+
+typedef remodule_dynlib_info_t* remodule_dynlib_t;
+
+static remodule_dynlib_t
+remodule_dynlib_open(const char* path) {
+	// Load once to find the real absolute path
+	HMODULE module = LoadLibraryExA(
+		path,
+		NULL,
+		DONT_RESOLVE_DLL_REFERENCES
+	);
+	if (module == NULL) { return NULL; }
+
+	char watch_path[MAX_PATH];
+	DWORD watch_path_len = GetModuleFileNameA(module, watch_path, sizeof(watch_path));
+	REMODULE_ASSERT(watch_path_len > 0, "Could not get module name");
+	FreeLibrary(module);
+
+	// Create a temporary file name
+	char dir_buf[MAX_PATH];
+	char name_buf[MAX_PATH];
+	char tmp_name_buf[MAX_PATH];
+	char* file_part;
+
+	GetFullPathNameA(watch_path, sizeof(dir_buf), dir_buf, &file_part);
+	size_t name_len = strlen(file_part);
+	memcpy(name_buf, file_part, name_len);
+	*file_part = '\0';
+	GetTempFileNameA(dir_buf, name_buf, 0, tmp_name_buf);
+
+	// Copy the file over
+	REMODULE_ASSERT(CopyFileA(watch_path, tmp_name_buf, FALSE), "Could not create temporary file");
+
+	// Load the temporary file
+	module = LoadLibraryA(tmp_name_buf);
+	if (module == NULL) { return NULL; }
+
+	remodule_dynlib_t lib = malloc(sizeof(remodule_dynlib_info_t) + watch_path_len + 1);
+	lib->handle = module;
+	memcpy(lib->watch_path, watch_path, watch_path_len);
+	lib->watch_path[watch_path_len] = '\0';
+	return lib;
+}
+
+static remodule_dynlib_t
+remodule_dynlib_open_private(const char* path, bool in_memory) {
+	// Every instance is already loaded from a temporary copy
+	(void)in_memory;
+	return remodule_dynlib_open(path);
+}
+
+static void*
+remodule_dynlib_find(remodule_dynlib_t lib, const char* name) {
+	return (void*)GetProcAddress(lib->handle, name);
+}
+
+static void
+remodule_dynlib_close(remodule_dynlib_t lib) {
+	char name_buf[MAX_PATH];
+	REMODULE_ASSERT(GetModuleFileNameA(lib->handle, name_buf, sizeof(name_buf)) > 0, "Could not get module name");
+
+	FreeLibrary(lib->handle);
+	DeleteFileA(name_buf);
+	free(lib);
+}
+
+static char*
+remodule_dynlib_get_path(remodule_dynlib_t lib) {
+	return _strdup(lib->watch_path);
+}
+
+static char*
+remodule_dynlib_get_private_path(remodule_dynlib_t lib) {
+	// The original path is recorded when the copy is made
+	return remodule_dynlib_get_path(lib);
+}
+
+static void
+remodule_dynlib_free_path(char* path) {
+	free(path);
+}
+
+static void
+remodule_dynlib_remove_stale_copies(const char* path) {
+	// A copy is locked while it is loaded and is deleted on close
+	(void)path;
+}
+
+static void*
+remodule_aligned_alloc(size_t size, size_t align) {
+	void* ptr = _aligned_malloc(size > 0 ? size : 1, align);
+	if (ptr != NULL) { memset(ptr, 0, size); }
+	return ptr;
+}
+
+static void
+remodule_aligned_free(void* ptr) {
+	_aligned_free(ptr);
+}
+
+typedef HANDLE remodule_thread_t;
+typedef volatile LONG remodule_atomic_int_t;
+typedef void* volatile remodule_atomic_ptr_t;
+typedef SRWLOCK remodule_mutex_t;
+
+#define REMODULE_MUTEX_INIT SRWLOCK_INIT
+
+typedef struct remodule_thread_start_s {
+	void(*fn)(void* arg);
+	void* arg;
+} remodule_thread_start_t;
+
+static DWORD WINAPI
+remodule_thread_entry(LPVOID arg) {
+	remodule_thread_start_t start = *(remodule_thread_start_t*)arg;
+	free(arg);
+	start.fn(start.arg);
+	return 0;
+}
+
+static bool
+remodule_thread_start(remodule_thread_t* thread, void(*fn)(void* arg), void* arg) {
+	remodule_thread_start_t* start = malloc(sizeof(remodule_thread_start_t));
+	*start = (remodule_thread_start_t){ .fn = fn, .arg = arg };
+	*thread = CreateThread(NULL, 0, remodule_thread_entry, start, 0, NULL);
+	if (*thread == NULL) {
+		free(start);
+		return false;
+	}
+
+	return true;
+}
+
+static void
+remodule_thread_join(remodule_thread_t thread) {
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+static int
+remodule_atomic_load(remodule_atomic_int_t* atomic) {
+	return (int)InterlockedCompareExchange(atomic, 0, 0);
+}
+
+static void
+remodule_atomic_store(remodule_atomic_int_t* atomic, int value) {
+	InterlockedExchange(atomic, value);
+}
+
+static int
+remodule_atomic_fetch_add(remodule_atomic_int_t* atomic, int value) {
+	return (int)InterlockedExchangeAdd(atomic, value);
+}
+
+static void
+remodule_atomic_exchange(remodule_atomic_int_t* atomic, int value) {
+	InterlockedExchange(atomic, value);
+}
+
+static bool
+remodule_atomic_cas(remodule_atomic_int_t* atomic, int expected, int value) {
+	return InterlockedCompareExchange(atomic, value, expected) == expected;
+}
+
+static void*
+remodule_atomic_ptr_load(remodule_atomic_ptr_t* atomic) {
+	return InterlockedCompareExchangePointer(atomic, NULL, NULL);
+}
+
+static void
+remodule_atomic_fn_store(remodule_fn_t volatile* atomic, remodule_fn_t value) {
+	InterlockedExchangePointer((void* volatile*)atomic, (void*)value);
+}
+
+static void
+remodule_atomic_export_store(remodule_export_t* atomic, remodule_export_t value) {
+	InterlockedExchangePointer((void* volatile*)&atomic->data, value.data);
+}
+
+static void
+remodule_atomic_ptr_store(remodule_atomic_ptr_t* atomic, void* value) {
+	InterlockedExchangePointer(atomic, value);
+}
+
+static bool
+remodule_atomic_ptr_cas(remodule_atomic_ptr_t* atomic, void* expected, void* value) {
+	return InterlockedCompareExchangePointer(atomic, value, expected) == expected;
+}
+
+static int
+remodule_atomic_load_seq_cst(remodule_atomic_int_t* atomic) {
+	return (int)InterlockedCompareExchange(atomic, 0, 0);
+}
+
+static void
+remodule_yield(void) {
+	SwitchToThread();
+}
+
+static bool
+remodule_process_barrier_supported(void) {
+	return true;
+}
+
+static void
+remodule_process_barrier(void) {
+	FlushProcessWriteBuffers();
+}
+
+static uint32_t
+remodule_call_counter_load(remodule_call_counter_t* counter) {
+	// Pairs with the release store of REMODULE_EXIT
+	return REMODULE__LOAD_ACQUIRE(&counter->state);
+}
+
+static void
+remodule_mutex_init(remodule_mutex_t* mutex) {
+	InitializeSRWLock(mutex);
+}
+
+static void
+remodule_mutex_lock(remodule_mutex_t* mutex) {
+	AcquireSRWLockExclusive(mutex);
+}
+
+static void
+remodule_mutex_unlock(remodule_mutex_t* mutex) {
+	ReleaseSRWLockExclusive(mutex);
+}
+
+static void
+remodule_mutex_destroy(remodule_mutex_t* mutex) {
+	(void)mutex;
+}
+
+static void
+remodule_tls_release_thread(int thread_id);
+
+static DWORD remodule_thread_exit_index = FLS_OUT_OF_INDEXES;
+static INIT_ONCE remodule_thread_exit_once = INIT_ONCE_STATIC_INIT;
+
+static void WINAPI
+remodule_thread_exit(void* value) {
+	// Also called for threads that never set a value when the index is freed
+	if (value != NULL) { remodule_tls_release_thread((int)(intptr_t)value); }
+}
+
+static BOOL CALLBACK
+remodule_thread_exit_init(PINIT_ONCE once, void* param, void** context) {
+	(void)once;
+	(void)param;
+	(void)context;
+	remodule_thread_exit_index = FlsAlloc(remodule_thread_exit);
+	return remodule_thread_exit_index != FLS_OUT_OF_INDEXES;
+}
+
+static void
+remodule_on_thread_exit(int thread_id) {
+	REMODULE_ASSERT(
+		InitOnceExecuteOnce(&remodule_thread_exit_once, remodule_thread_exit_init, NULL, NULL),
+		"Could not allocate fiber local storage"
+	);
+	FlsSetValue(remodule_thread_exit_index, (void*)(intptr_t)thread_id);
+}
+
+static uint64_t
+remodule_now_ns(void) {
+	static LARGE_INTEGER frequency;
+	if (frequency.QuadPart == 0) { QueryPerformanceFrequency(&frequency); }
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(
+		counter.QuadPart / frequency.QuadPart * 1000000000ull
+		+ counter.QuadPart % frequency.QuadPart * 1000000000ull / frequency.QuadPart
+	);
+}
+
+static int
+remodule_num_cpus(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+
+typedef struct remodule_mapping_s {
+	HANDLE file;
+	HANDLE mapping;
+	void* data;
+	size_t size;
+} remodule_mapping_t;
+
+static bool
+remodule_mapping_open(remodule_mapping_t* mapping, const char* path) {
+	*mapping = (remodule_mapping_t){ 0 };
+
+	mapping->file = CreateFileA(
+		path,
+		GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_DELETE,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+	if (mapping->file == INVALID_HANDLE_VALUE) { return false; }
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mapping->file, &size) || size.QuadPart == 0) {
+		CloseHandle(mapping->file);
+		return false;
+	}
+	mapping->size = (size_t)size.QuadPart;
+
+	mapping->mapping = CreateFileMappingA(mapping->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping->mapping == NULL) {
+		CloseHandle(mapping->file);
+		return false;
+	}
+
+	mapping->data = MapViewOfFile(mapping->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (mapping->data == NULL) {
+		CloseHandle(mapping->mapping);
+		CloseHandle(mapping->file);
+		return false;
+	}
+
+	return true;
+}
+
+static void
+remodule_mapping_close(remodule_mapping_t* mapping) {
+	UnmapViewOfFile(mapping->data);
+	CloseHandle(mapping->mapping);
+	CloseHandle(mapping->file);
+}
+
+static bool
+remodule_mapping_map_pages(
+	const remodule_mapping_t* mapping,
+	size_t offset,
+	void* addr,
+	size_t size
+) {
+	// Views cannot be placed over an existing image
+	(void)mapping;
+	(void)offset;
+	(void)addr;
+	(void)size;
+	return false;
+}
+
+static size_t
+remodule_page_size(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+}
+
+static FILE*
+remodule_create_temp_file(char* path_template) {
+	// _mktemp_s only picks a name, from the process id and a letter
+	if (_mktemp_s(path_template, strlen(path_template) + 1) != 0) { return NULL; }
+	return fopen(path_template, "wbx");
+}
+
+static bool
+remodule_replace_file(const char* src, const char* dst) {
+	return MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+static bool
+remodule_read_build_id(FILE* file, const void** id, size_t* id_size, void* buf, size_t buf_size) {
+	// PE images have no build id, their content is hashed instead
+	(void)file;
+	(void)id;
+	(void)id_size;
+	(void)buf;
+	(void)buf_size;
+	return false;
+}
+
+static char remodule_error_msg_buf[2048];
+
+const char*
+remodule_last_error(void) {
+	FormatMessageA(
+		FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+		NULL,
+		GetLastError(),
+		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+		remodule_error_msg_buf,
+		sizeof(remodule_error_msg_buf),
+		NULL
+	);
+	return remodule_error_msg_buf;
+}
+
+#elif defined(__unix__) || defined(__APPLE__)
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <linux/membarrier.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+#define REMODULE_PATH_MAX PATH_MAX
+
+typedef struct remodule_dynlib_info_s {
+	void* handle;
+	// Where a private copy was made from, NULL when loaded in place
+	char* source_path;
+	// Keeps a copy in memory alive, -1 otherwise
+	int mem_fd;
+	// A copy on disk, deleted on close, empty otherwise
+	char copy_path[];
+} remodule_dynlib_info_t;
+
+typedef remodule_dynlib_info_t* remodule_dynlib_t;
+
+static remodule_dynlib_t
+remodule_dynlib_wrap(void* handle, char* source_path, int mem_fd, const char* copy_path) {
+	size_t copy_path_len = strlen(copy_path);
+	remodule_dynlib_t lib = malloc(sizeof(remodule_dynlib_info_t) + copy_path_len + 1);
+	lib->handle = handle;
+	lib->source_path = source_path;
+	lib->mem_fd = mem_fd;
+	memcpy(lib->copy_path, copy_path, copy_path_len + 1);
+	return lib;
+}
+
+static remodule_dynlib_t
+remodule_dynlib_open(const char* path) {
+	void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) { return NULL; }
+
+	return remodule_dynlib_wrap(handle, NULL, -1, "");
+}
+
+static bool
+remodule_copy_file(int out_fd, int in_fd) {
+#if defined(__linux__)
+	// Copy in the kernel first.
+	// copy_file_range can share extents but may refuse to cross filesystems,
+	// sendfile works with any destination.
+	struct stat stat_buf;
+	if (fstat(in_fd, &stat_buf) == 0) {
+		size_t remaining = (size_t)stat_buf.st_size;
+		while (remaining > 0) {
+			ssize_t num_bytes_copied = copy_file_range(in_fd, NULL, out_fd, NULL, remaining, 0);
+			if (num_bytes_copied < 0 && errno == EINTR) { continue; }
+			if (num_bytes_copied <= 0) { break; }
+			remaining -= (size_t)num_bytes_copied;
+		}
+
+		while (remaining > 0) {
+			ssize_t num_bytes_copied = sendfile(out_fd, in_fd, NULL, remaining);
+			if (num_bytes_copied < 0 && errno == EINTR) { continue; }
+			if (num_bytes_copied <= 0) { break; }
+			remaining -= (size_t)num_bytes_copied;
+		}
+	}
+#endif
+
+	// Copy whatever is left from the current offsets
+	char buf[65536];
+	while (true) {
+		ssize_t num_bytes_read = read(in_fd, buf, sizeof(buf));
+		if (num_bytes_read == 0) { return true; }
+		if (num_bytes_read < 0) {
+			if (errno == EINTR) { continue; }
+			return false;
+		}
+
+		for (ssize_t offset = 0; offset < num_bytes_read;) {
+			ssize_t num_bytes_written = write(out_fd, buf + offset, num_bytes_read - offset);
+			if (num_bytes_written < 0) {
+				if (errno == EINTR) { continue; }
+				return false;
+			}
+			offset += num_bytes_written;
+		}
+	}
+}
+
+static bool
+remodule_dynlib_name_taken(const char* path) {
+	// The loader matches loaded objects by name before it looks at the file
+	void* lib = dlopen(path, RTLD_LAZY | RTLD_NOLOAD);
+	if (lib == NULL) {
+		dlerror();
+		return false;
+	}
+
+	dlclose(lib);
+	return true;
+}
+
+#if defined(__linux__)
+static void*
+remodule_dynlib_load_memfd(int in_fd, int* mem_fd_out) {
+	int mem_fd = memfd_create("remodule", MFD_CLOEXEC);
+	if (mem_fd < 0) { return NULL; }
+	if (!remodule_copy_file(mem_fd, in_fd)) {
+		close(mem_fd);
+		return NULL;
+	}
+
+	char fd_path[64];
+	while (true) {
+		snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", mem_fd);
+		if (!remodule_dynlib_name_taken(fd_path)) { break; }
+
+		// An image loaded from a recycled descriptor number is still around
+		int new_fd = fcntl(mem_fd, F_DUPFD_CLOEXEC, mem_fd + 1);
+		close(mem_fd);
+		mem_fd = new_fd;
+		if (mem_fd < 0) { return NULL; }
+	}
+
+	// The descriptor stays open so that the name of the image stays valid
+	void* handle = dlopen(fd_path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		close(mem_fd);
+		return NULL;
+	}
+
+	*mem_fd_out = mem_fd;
+	return handle;
+}
+#endif
+
+static void*
+remodule_dynlib_load_copy(const char* source_path, int in_fd, char* copy_path, size_t copy_path_size) {
+	// A hidden file next to the module keeps $ORIGIN and debuggers working.
+	// The pid tells copies of a process that died, see remodule_dynlib_remove_stale_copies.
+	const char* name = strrchr(source_path, '/') + 1;
+	int dir_len = (int)(name - source_path);
+
+	int out_fd;
+	do {
+		int len = snprintf(
+			copy_path, copy_path_size, "%.*s.%s.%ld.XXXXXX",
+			dir_len, source_path, name, (long)getpid()
+		);
+		if (len < 0 || (size_t)len >= copy_path_size) {
+			errno = ENAMETOOLONG;
+			return NULL;
+		}
+
+		out_fd = mkstemp(copy_path);
+		if (out_fd < 0) { return NULL; }
+
+		if (remodule_dynlib_name_taken(copy_path)) {
+			close(out_fd);
+			unlink(copy_path);
+			out_fd = -1;
+		}
+	} while (out_fd < 0);
+
+	void* handle = NULL;
+	if (remodule_copy_file(out_fd, in_fd)) {
+		handle = dlopen(copy_path, RTLD_NOW | RTLD_LOCAL);
+	}
+	close(out_fd);
+
+	// Otherwise, the file is deleted when the image is closed
+	if (handle == NULL) { unlink(copy_path); }
+	return handle;
+}
+
+static void
+remodule_dynlib_remove_stale_copies(const char* path) {
+	char* source_path = realpath(path, NULL);
+	if (source_path == NULL) { return; }
+
+	char* name = strrchr(source_path, '/') + 1;
+	size_t name_len = strlen(name);
+	char dir_path[REMODULE_PATH_MAX];
+	snprintf(dir_path, sizeof(dir_path), "%.*s", (int)(name - source_path), source_path);
+
+	DIR* dir = opendir(dir_path);
+	if (dir == NULL) {
+		free(source_path);
+		return;
+	}
+
+	// Only copies of this module, named .<name>.<pid>.XXXXXX
+	for (struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+		const char* entry_name = entry->d_name;
+		if (
+			entry_name[0] != '.'
+			|| strncmp(entry_name + 1, name, name_len) != 0
+			|| entry_name[name_len + 1] != '.'
+		) {
+			continue;
+		}
+
+		const char* pid_str = entry_name + name_len + 2;
+		char* pid_end;
+		long pid = strtol(pid_str, &pid_end, 10);
+		if (pid <= 0 || pid_end == pid_str || *pid_end != '.' || strlen(pid_end + 1) != 6) {
+			continue;
+		}
+
+		// The process that made it crashed before closing it
+		if (kill((pid_t)pid, 0) == 0 || errno != ESRCH) { continue; }
+
+		char copy_path[REMODULE_PATH_MAX];
+		int len = snprintf(copy_path, sizeof(copy_path), "%s%s", dir_path, entry_name);
+		if (len > 0 && (size_t)len < sizeof(copy_path)) { unlink(copy_path); }
+	}
+
+	closedir(dir);
+	free(source_path);
+}
+
+static remodule_dynlib_t
+remodule_dynlib_open_private(const char* path, bool in_memory) {
+	// dlopen hands back the cached object for a file that is still loaded.
+	// Load a uniquely named copy instead.
+	char* source_path = realpath(path, NULL);
+	if (source_path == NULL) { return NULL; }
+
+	int in_fd = open(source_path, O_RDONLY | O_CLOEXEC);
+	if (in_fd < 0) {
+		free(source_path);
+		return NULL;
+	}
+
+	void* handle;
+	int mem_fd = -1;
+	char copy_path[REMODULE_PATH_MAX] = "";
+#if defined(__linux__)
+	if (in_memory) {
+		handle = remodule_dynlib_load_memfd(in_fd, &mem_fd);
+	} else {
+		handle = remodule_dynlib_load_copy(source_path, in_fd, copy_path, sizeof(copy_path));
+	}
+#else
+	// There is no anonymous file to load from
+	(void)in_memory;
+	handle = remodule_dynlib_load_copy(source_path, in_fd, copy_path, sizeof(copy_path));
+#endif
+	close(in_fd);
+
+	if (handle == NULL) {
+		free(source_path);
+		return NULL;
+	}
+
+	return remodule_dynlib_wrap(handle, source_path, mem_fd, copy_path);
+}
+
+static void*
+remodule_dynlib_find(remodule_dynlib_t lib, const char* name) {
+	return dlsym(lib->handle, name);
+}
+
+static void
+remodule_dynlib_close(remodule_dynlib_t lib) {
+	dlclose(lib->handle);
+	if (lib->copy_path[0] != '\0') { unlink(lib->copy_path); }
+	if (lib->mem_fd >= 0) { close(lib->mem_fd); }
+	free(lib->source_path);
+	free(lib);
+}
+
+static char*
+remodule_dynlib_get_path(remodule_dynlib_t lib) {
+	struct link_map* link_map;
+	REMODULE_ASSERT(
+		dlinfo(lib->handle, RTLD_DI_LINKMAP, &link_map) == 0,
+		"Could not read library info"
+	);
+
+	size_t size = strlen(link_map->l_name) + 1;
+	char* path = malloc(size);
+	if (path == NULL) { return NULL; }
+	memcpy(path, link_map->l_name, size);
+
+	return path;
+}
+
+static char*
+remodule_dynlib_get_private_path(remodule_dynlib_t lib) {
+	// The loader only knows the copy, the source was resolved when it was made
+	size_t size = strlen(lib->source_path) + 1;
+	char* source_path = malloc(size);
+	if (source_path == NULL) { return NULL; }
+	memcpy(source_path, lib->source_path, size);
+
+	return source_path;
+}
+
+static void
+remodule_dynlib_free_path(char* path) {
+	free(path);
+}
+
+static void*
+remodule_aligned_alloc(size_t size, size_t align) {
+	// calloc hands out lazily zeroed pages for large blocks
+	if (align <= _Alignof(max_align_t)) { return calloc(1, size > 0 ? size : 1); }
+
+	void* ptr;
+	if (posix_memalign(&ptr, align, size > 0 ? size : 1) != 0) { return NULL; }
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+static void
+remodule_aligned_free(void* ptr) {
+	free(ptr);
+}
+
+typedef pthread_t remodule_thread_t;
+typedef atomic_int remodule_atomic_int_t;
+typedef _Atomic(void*) remodule_atomic_ptr_t;
+typedef pthread_mutex_t remodule_mutex_t;
+
+#define REMODULE_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+
+typedef struct remodule_thread_start_s {
+	void(*fn)(void* arg);
+	void* arg;
+} remodule_thread_start_t;
+
+static void*
+remodule_thread_entry(void* arg) {
+	remodule_thread_start_t start = *(remodule_thread_start_t*)arg;
+	free(arg);
+	start.fn(start.arg);
+	return NULL;
+}
+
+static bool
+remodule_thread_start(remodule_thread_t* thread, void(*fn)(void* arg), void* arg) {
+	remodule_thread_start_t* start = malloc(sizeof(remodule_thread_start_t));
+	*start = (remodule_thread_start_t){ .fn = fn, .arg = arg };
+	int error = pthread_create(thread, NULL, remodule_thread_entry, start);
+	if (error != 0) {
+		free(start);
+		errno = error;
+		return false;
+	}
+
+	return true;
+}
+
+static void
+remodule_thread_join(remodule_thread_t thread) {
+	pthread_join(thread, NULL);
+}
+
+static int
+remodule_atomic_load(remodule_atomic_int_t* atomic) {
+	return atomic_load_explicit(atomic, memory_order_acquire);
+}
+
+static void
+remodule_atomic_store(remodule_atomic_int_t* atomic, int value) {
+	atomic_store_explicit(atomic, value, memory_order_release);
+}
+
+static int
+remodule_atomic_fetch_add(remodule_atomic_int_t* atomic, int value) {
+	return atomic_fetch_add_explicit(atomic, value, memory_order_relaxed);
+}
+
+// The ones below are sequentially consistent, for the reader protocol
+
+static void
+remodule_atomic_exchange(remodule_atomic_int_t* atomic, int value) {
+	atomic_exchange(atomic, value);
+}
+
+static bool
+remodule_atomic_cas(remodule_atomic_int_t* atomic, int expected, int value) {
+	return atomic_compare_exchange_strong(atomic, &expected, value);
+}
+
+static void*
+remodule_atomic_ptr_load(remodule_atomic_ptr_t* atomic) {
+	return atomic_load(atomic);
+}
+
+static void
+remodule_atomic_fn_store(remodule_fn_t volatile* atomic, remodule_fn_t value) {
+	// Pairs with the acquire load of REMODULE_CALL
+	__atomic_store_n(atomic, value, __ATOMIC_RELEASE);
+}
+
+static void
+remodule_atomic_export_store(remodule_export_t* atomic, remodule_export_t value) {
+	// Pairs with the acquire loads of REMODULE_EXPORTED_FN and REMODULE_EXPORTED_DATA
+	__atomic_store(atomic, &value, __ATOMIC_RELEASE);
+}
+
+static void
+remodule_atomic_ptr_store(remodule_atomic_ptr_t* atomic, void* value) {
+	atomic_store(atomic, value);
+}
+
+static bool
+remodule_atomic_ptr_cas(remodule_atomic_ptr_t* atomic, void* expected, void* value) {
+	return atomic_compare_exchange_strong(atomic, &expected, value);
+}
+
+static int
+remodule_atomic_load_seq_cst(remodule_atomic_int_t* atomic) {
+	return atomic_load(atomic);
+}
+
+static void
+remodule_yield(void) {
+	sched_yield();
+}
+
+#if defined(__linux__)
+static int
+remodule_membarrier_cmd(void) {
+	// Found once for the whole process, registration included
+	static remodule_atomic_int_t found_cmd = 0;
+	int cmd = remodule_atomic_load(&found_cmd);
+	if (cmd != 0) { return cmd; }
+
+	// Fails before Linux 4.3 and under seccomp filters that deny it
+	long supported_cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0);
+	if (supported_cmds < 0) {
+		cmd = -1;
+	} else if (
+		(supported_cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) != 0
+		&& syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0
+	) {
+		cmd = MEMBARRIER_CMD_PRIVATE_EXPEDITED;
+	} else if ((supported_cmds & MEMBARRIER_CMD_SHARED) != 0) {
+		// Before Linux 4.14, waits for every CPU to schedule
+		cmd = MEMBARRIER_CMD_SHARED;
+	} else {
+		cmd = -1;
+	}
+
+	remodule_atomic_store(&found_cmd, cmd);
+	return cmd;
+}
+#endif
+
+static bool
+remodule_process_barrier_supported(void) {
+#if defined(__linux__)
+	return remodule_membarrier_cmd() > 0;
+#else
+	return false;
+#endif
+}
+
+static void
+remodule_process_barrier(void) {
+#if defined(__linux__)
+	int cmd = remodule_membarrier_cmd();
+	if (cmd > 0) {
+		REMODULE_ASSERT(syscall(SYS_membarrier, cmd, 0) == 0, "membarrier failed");
+		return;
+	}
+#endif
+
+	// Every REMODULE_ENTER has a full fence of its own
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static uint32_t
+remodule_call_counter_load(remodule_call_counter_t* counter) {
+	return REMODULE__LOAD_ACQUIRE(&counter->state);
+}
+
+static void
+remodule_mutex_init(remodule_mutex_t* mutex) {
+	pthread_mutex_init(mutex, NULL);
+}
+
+static void
+remodule_mutex_lock(remodule_mutex_t* mutex) {
+	pthread_mutex_lock(mutex);
+}
+
+static void
+remodule_mutex_unlock(remodule_mutex_t* mutex) {
+	pthread_mutex_unlock(mutex);
+}
+
+static void
+remodule_mutex_destroy(remodule_mutex_t* mutex) {
+	pthread_mutex_destroy(mutex);
+}
+
+static void
+remodule_tls_release_thread(int thread_id);
+
+static pthread_key_t remodule_thread_exit_key;
+static pthread_once_t remodule_thread_exit_once = PTHREAD_ONCE_INIT;
+
+static void
+remodule_thread_exit(void* value) {
+	remodule_tls_release_thread((int)(intptr_t)value);
+}
+
+static void
+remodule_thread_exit_init(void) {
+	REMODULE_ASSERT(
+		pthread_key_create(&remodule_thread_exit_key, remodule_thread_exit) == 0,
+		"Could not create thread key"
+	);
+}
+
+static void
+remodule_on_thread_exit(int thread_id) {
+	pthread_once(&remodule_thread_exit_once, remodule_thread_exit_init);
+	pthread_setspecific(remodule_thread_exit_key, (void*)(intptr_t)thread_id);
+}
+
+static uint64_t
+remodule_now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static int
+remodule_num_cpus(void) {
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return num_cpus > 0 ? (int)num_cpus : 1;
+}
+
+typedef struct remodule_mapping_s {
+	int fd;
+	void* data;
+	size_t size;
+} remodule_mapping_t;
+
+static bool
+remodule_mapping_open(remodule_mapping_t* mapping, const char* path) {
+	*mapping = (remodule_mapping_t){ .fd = -1 };
+
+	mapping->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (mapping->fd < 0) { return false; }
+
+	struct stat stat_buf;
+	if (fstat(mapping->fd, &stat_buf) != 0 || stat_buf.st_size == 0) {
+		close(mapping->fd);
+		return false;
+	}
+	mapping->size = (size_t)stat_buf.st_size;
+
+	mapping->data = mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE, mapping->fd, 0);
+	if (mapping->data == MAP_FAILED) {
+		close(mapping->fd);
+		return false;
+	}
+
+	return true;
+}
+
+static void
+remodule_mapping_close(remodule_mapping_t* mapping) {
+	munmap(mapping->data, mapping->size);
+	close(mapping->fd);
+}
+
+static bool
+remodule_mapping_map_pages(
+	const remodule_mapping_t* mapping,
+	size_t offset,
+	void* addr,
+	size_t size
+) {
+	// Copy-on-write pages of the file replace the pages of the variable
+	return mmap(
+		addr,
+		size,
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_FIXED,
+		mapping->fd,
+		(off_t)offset
+	) != MAP_FAILED;
+}
+
+static size_t
+remodule_page_size(void) {
+	return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static FILE*
+remodule_create_temp_file(char* path_template) {
+	int fd = mkstemp(path_template);
+	if (fd < 0) { return NULL; }
+
+	FILE* file = fdopen(fd, "wb");
+	if (file == NULL) {
+		close(fd);
+		unlink(path_template);
+	}
+	return file;
+}
+
+static bool
+remodule_replace_file(const char* src, const char* dst) {
+	return rename(src, dst) == 0;
+}
+
+static bool
+remodule_read_build_id(FILE* file, const void** id, size_t* id_size, void* buf, size_t buf_size) {
+	ElfW(Ehdr) header;
+	if (
+		fread(&header, sizeof(header), 1, file) != 1
+		|| memcmp(header.e_ident, ELFMAG, SELFMAG) != 0
+		|| header.e_ident[EI_CLASS] != (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32)
+		|| header.e_phentsize != sizeof(ElfW(Phdr))
+	) {
+		return false;
+	}
+
+	for (size_t i = 0; i < header.e_phnum; ++i) {
+		ElfW(Phdr) phdr;
+		if (
+			fseek(file, (long)(header.e_phoff + i * sizeof(phdr)), SEEK_SET) != 0
+			|| fread(&phdr, sizeof(phdr), 1, file) != 1
+		) {
+			return false;
+		}
+		if (phdr.p_type != PT_NOTE || phdr.p_filesz > buf_size) { continue; }
+
+		if (
+			fseek(file, (long)phdr.p_offset, SEEK_SET) != 0
+			|| fread(buf, phdr.p_filesz, 1, file) != 1
+		) {
+			return false;
+		}
+
+		size_t align = phdr.p_align == 8 ? 8 : 4;
+		size_t offset = 0;
+		while (offset + sizeof(ElfW(Nhdr)) <= phdr.p_filesz) {
+			ElfW(Nhdr) note;
+			memcpy(&note, (char*)buf + offset, sizeof(note));
+			size_t name_offset = offset + sizeof(note);
+			size_t desc_offset = name_offset + ((note.n_namesz + align - 1) & ~(align - 1));
+			size_t next_offset = desc_offset + ((note.n_descsz + align - 1) & ~(align - 1));
+			if (desc_offset + note.n_descsz > phdr.p_filesz) { break; }
+
+			if (
+				note.n_type == NT_GNU_BUILD_ID
+				&& note.n_namesz == sizeof("GNU")
+				&& memcmp((char*)buf + name_offset, "GNU", sizeof("GNU")) == 0
+			) {
+				*id = (char*)buf + desc_offset;
+				*id_size = note.n_descsz;
+				return true;
+			}
+
+			offset = next_offset;
+		}
+	}
+
+	return false;
+}
+
+const char*
+remodule_last_error(void) {
+	const char* dlerror_str = dlerror();
+	return dlerror_str != NULL ? dlerror_str : strerror(errno);
+}
+
+#endif
+
+typedef struct remodule_tmp_var_storage_s {
+	char* name;
+	void* value;
+	size_t name_length;
+	size_t value_size;
+	const remodule_field_info_t* fields;
+	size_t num_fields;
+	size_t value_align;
+	uint32_t hash;
+} remodule_tmp_var_storage_t;
+
+typedef struct remodule_var_s {
+	const remodule_var_info_t* info;
+	uint32_t hash;
+	bool restored;
+} remodule_var_t;
+
+typedef struct remodule_anchor_s {
+	const char* name;
+	size_t name_length;
+	uintptr_t addr;
+	size_t size;
+	uint32_t hash;
+} remodule_anchor_t;
+
+typedef struct remodule_export_table_s {
+	remodule_export_t* entries;
+	size_t capacity;
+} remodule_export_table_t;
+
+typedef struct remodule_var_table_s {
+	remodule_var_t* vars;
+	size_t num_vars;
+	remodule_var_t* host_vars;
+	size_t num_host_vars;
+	remodule_var_t* relocatables;
+	size_t num_relocatables;
+	size_t num_pointer_fields;
+	size_t num_exports;
+	size_t capacity;
+	size_t names_size;
+	size_t values_size;
+	size_t num_fields;
+} remodule_var_table_t;
+
+#define REMODULE_CHUNK_SIZE (64 * 1024)
+#define REMODULE_POOL_MIN_SIZE 16
+#define REMODULE_POOL_NUM_CLASSES 9
+#define REMODULE_MAX_ALIGN _Alignof(max_align_t)
+
+typedef struct remodule_chunk_s {
+	struct remodule_chunk_s* next;
+	size_t size;
+} remodule_chunk_t;
+
+typedef struct remodule_bump_s {
+	remodule_chunk_t* chunks;
+	char* ptr;
+	char* end;
+	size_t reserved;
+	size_t min_chunk_size;
+} remodule_bump_t;
+
+typedef union remodule_large_block_u {
+	struct {
+		union remodule_large_block_u* prev;
+		union remodule_large_block_u* next;
+	} link;
+	max_align_t align;
+} remodule_large_block_t;
+
+#define REMODULE_CACHE_LINE_SIZE 64
+
+struct remodule_reader_s {
+	remodule_t* mod;
+	struct remodule_reader_s* next;
+	// Epoch at the start of the current read section, 0 outside of one
+	remodule_atomic_int_t epoch;
+	remodule_atomic_int_t in_use;
+};
+
+typedef struct remodule_call_counter_slot_s {
+	// First so that the public pointer converts back
+	remodule_call_counter_t counter;
+	struct remodule_call_counter_slot_s* next;
+	remodule_atomic_int_t in_use;
+} remodule_call_counter_slot_t;
+
+typedef struct remodule_tls_storage_s {
+	char* name;
+	void* value;
+	size_t name_length;
+	size_t value_size;
+	size_t value_align;
+	int thread_id;
+	uint32_t hash;
+} remodule_tls_storage_t;
+
+typedef struct remodule_function_s {
+	remodule_fn_t volatile fn;
+	char* name;
+	size_t name_length;
+	uint32_t hash;
+} remodule_function_t;
+
+typedef struct remodule_retired_s {
+	remodule_dynlib_t lib;
+	// Host storage that only this instance was bound to, released with it
+	remodule_tmp_var_storage_t* host_storage;
+	size_t num_host_storage;
+	int epoch;
+} remodule_retired_t;
+
+struct remodule_s {
+	void* userdata;
+	remodule_plugin_info_t info;
+	remodule_dynlib_t lib;
+	char* path;
+
+	// Vars of the currently loaded instance, scanned once per load
+	remodule_var_table_t vars;
+	// An instance being staged, swapped with the above on commit
+	remodule_dynlib_t staged_lib;
+	remodule_plugin_info_t staged_info;
+	remodule_var_table_t staged_vars;
+
+	remodule_stats_t stats;
+	uint64_t stage_ns;
+
+	// Identity of the image on disk, see remodule_image_id
+	uint64_t image_id;
+	uint64_t staged_image_id;
+	bool has_image_id;
+	bool staged_has_image_id;
+	bool reload_unchanged;
+	// Private copies go to a memfd instead of next to the module
+	bool in_memory;
+
+	char* snapshot_path;
+
+	// Where persisted and relocatable symbols were in the old instance
+	remodule_anchor_t* old_anchors;
+	size_t num_old_anchors;
+	size_t old_anchor_capacity;
+	char* old_anchor_names;
+	size_t old_anchor_names_capacity;
+
+	// Storage of host-owned vars, kept across reloads
+	remodule_tmp_var_storage_t* host_storage;
+	size_t num_host_storage;
+	size_t host_storage_capacity;
+	// Storage the new instance no longer uses, released with the old instance
+	remodule_tmp_var_storage_t* dropped_host_storage;
+	size_t num_dropped_host_storage;
+	size_t dropped_host_storage_capacity;
+
+	// Storage of thread-local vars for every thread, kept across reloads
+	// and released when a thread exits, see remodule_tls_release_thread
+	remodule_mutex_t tls_mutex;
+	struct remodule_s* tls_prev;
+	struct remodule_s* tls_next;
+	remodule_tls_storage_t* tls_storage;
+	size_t num_tls_storage;
+	size_t tls_storage_capacity;
+	uint32_t* tls_index;
+	size_t tls_index_capacity;
+
+	// Indexed exports of the current instance
+	remodule_export_t* exports;
+	size_t num_exports;
+	size_t exports_capacity;
+	// Tables outgrown by a reload, hosts may still hold them
+	remodule_export_table_t* old_exports;
+	size_t num_old_exports;
+
+	// Entry points of exported functions, retargeted on reload
+	remodule_function_t** functions;
+	size_t num_functions;
+	size_t functions_capacity;
+
+	// Allocators handed to the plugin, kept across reloads
+	remodule_bump_t arena;
+	remodule_bump_t pool_arena;
+	void* pool_free_lists[REMODULE_POOL_NUM_CLASSES];
+	remodule_large_block_t* large_blocks;
+	remodule_bump_t frame;
+
+	// Concurrent readers
+	remodule_atomic_ptr_t published;
+	remodule_atomic_ptr_t readers;
+	remodule_atomic_int_t epoch;
+	remodule_atomic_ptr_t call_counters;
+	remodule_retired_t* retired;
+	size_t num_retired;
+	size_t retired_capacity;
+
+	// Background staging
+	remodule_thread_t stage_thread;
+	remodule_atomic_int_t reload_status;
+	char reload_error[256];
+
+	// Reused between reloads to hold the snapshot and its index
+	void* scratch_buf;
+	size_t scratch_size;
+};
+
+static remodule_stats_hook_t remodule_stats_hook_fn = NULL;
+static void* remodule_stats_hook_userdata = NULL;
+
+static void
+remodule_record_timing(remodule_timing_t* timing, uint64_t duration_ns) {
+	timing->last_ns = duration_ns;
+	timing->total_ns += duration_ns;
+	if (duration_ns > timing->max_ns) { timing->max_ns = duration_ns; }
+
+	int bucket = 0;
+	for (
+		uint64_t duration_us = duration_ns / 1000;
+		duration_us > 0 && bucket < REMODULE_HISTOGRAM_BUCKETS - 1;
+		duration_us >>= 1
+	) {
+		++bucket;
+	}
+	++timing->histogram[bucket];
+}
+
+static uint64_t
+remodule_record_phase(remodule_t* mod, remodule_phase_t phase, uint64_t start_ns) {
+	uint64_t now_ns = remodule_now_ns();
+	remodule_record_timing(&mod->stats.phases[phase], now_ns - start_ns);
+	return now_ns;
+}
+
+static void
+remodule_notify_stats(remodule_t* mod, remodule_op_t op) {
+	if (remodule_stats_hook_fn != NULL) {
+		remodule_stats_hook_fn(mod, op, &mod->stats, remodule_stats_hook_userdata);
+	}
+}
+
+static void
+remodule_finish_reload(remodule_t* mod, uint64_t start_ns) {
+	++mod->stats.reload_count;
+	remodule_record_timing(&mod->stats.reload, remodule_now_ns() - start_ns);
+	remodule_notify_stats(mod, REMODULE_OP_AFTER_RELOAD);
+}
+
+static uint32_t
+remodule_hash(const char* str, size_t length) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static uint64_t
+remodule_hash64(uint64_t hash, const void* data, size_t size) {
+	// A word at a time, this only has to tell builds apart
+	const char* bytes = data;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ull;
+		hash ^= hash >> 32;
+	}
+	for (; i < size; ++i) {
+		hash = (hash ^ (unsigned char)bytes[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static bool
+remodule_image_id(const char* path, uint64_t* id) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) { return false; }
+
+	char buf[16384];
+	const void* build_id;
+	size_t build_id_size;
+	bool found;
+	if (remodule_read_build_id(file, &build_id, &build_id_size, buf, sizeof(buf))) {
+		// Seeds differ so that a build id never matches a content hash
+		*id = remodule_hash64(0x6275696c642d6964ull, build_id, build_id_size);
+		found = true;
+	} else {
+		uint64_t hash = 0xcbf29ce484222325ull;
+		size_t num_bytes_read;
+		rewind(file);
+		while ((num_bytes_read = fread(buf, 1, sizeof(buf), file)) > 0) {
+			hash = remodule_hash64(hash, buf, num_bytes_read);
+		}
+		*id = hash;
+		found = ferror(file) == 0;
+	}
+
+	fclose(file);
+	return found;
+}
+
+static void
+remodule_scan_vars(remodule_var_table_t* table, const remodule_plugin_info_t* info) {
+	table->num_vars = 0;
+	table->num_host_vars = 0;
+	table->num_relocatables = 0;
+	table->num_pointer_fields = 0;
+	table->num_exports = 0;
+	table->names_size = 0;
+	table->values_size = 0;
+	table->num_fields = 0;
+
+	size_t max_num_vars = info->var_info_end - info->var_info_begin;
+	if (max_num_vars > table->capacity) {
+		free(table->vars);
+		free(table->host_vars);
+		free(table->relocatables);
+		table->vars = malloc(max_num_vars * sizeof(remodule_var_t));
+		table->host_vars = malloc(max_num_vars * sizeof(remodule_var_t));
+		table->relocatables = malloc(max_num_vars * sizeof(remodule_var_t));
+		table->capacity = max_num_vars;
+	}
+
+	for (
+		const remodule_var_info_t* const* itr = info->var_info_begin;
+		itr != info->var_info_end;
+		++itr
+	) {
+		if (*itr == NULL) { continue; }
+		const remodule_var_info_t* var_info = *itr;
+
+		remodule_var_t var = {
+			.info = var_info,
+			.hash = remodule_hash(var_info->name, var_info->name_length),
+		};
+		if ((var_info->flags & REMODULE_VAR_FLAG_HOST_OWNED) != 0) {
+			table->host_vars[table->num_host_vars++] = var;
+			continue;
+		}
+		if ((var_info->flags & REMODULE_VAR_FLAG_RELOCATABLE) != 0) {
+			table->relocatables[table->num_relocatables++] = var;
+			if (
+				(var_info->flags & REMODULE_VAR_FLAG_INDEXED) != 0
+				&& var_info->export_id >= table->num_exports
+			) {
+				table->num_exports = var_info->export_id + 1;
+			}
+			continue;
+		}
+		// Bound lazily, see remodule_tls_bind
+		if ((var_info->flags & REMODULE_VAR_FLAG_THREAD_LOCAL) != 0) { continue; }
+
+		table->vars[table->num_vars++] = var;
+		table->names_size += var_info->name_length;
+		// Snapshot slots are aligned for any type, see remodule_reload
+		table->values_size += (var_info->value_size + REMODULE_MAX_ALIGN - 1) & ~(REMODULE_MAX_ALIGN - 1);
+
+		table->num_fields += var_info->num_fields;
+		for (size_t i = 0; i < var_info->num_fields; ++i) {
+			table->names_size += var_info->fields[i].name_length + var_info->fields[i].type_name_length;
+			if ((var_info->fields[i].flags & REMODULE_FIELD_FLAG_POINTER) != 0) {
+				++table->num_pointer_fields;
+			}
+		}
+	}
+}
+
+// Two exports at one index would silently replace each other
+static bool
+remodule_check_export_ids(const remodule_var_table_t* table) {
+	if (table->num_exports == 0) { return true; }
+
+	bool* taken = calloc(table->num_exports, sizeof(bool));
+	REMODULE_ASSERT(taken != NULL, "Could not allocate export ids");
+	bool unique = true;
+	for (size_t i = 0; unique && i < table->num_relocatables; ++i) {
+		const remodule_var_info_t* var_info = table->relocatables[i].info;
+		if ((var_info->flags & REMODULE_VAR_FLAG_INDEXED) == 0) { continue; }
+
+		unique = !taken[var_info->export_id];
+		taken[var_info->export_id] = true;
+	}
+	free(taken);
+	return unique;
+}
+
+static void*
+remodule_scratch(remodule_t* mod, size_t size) {
+	if (size > mod->scratch_size) {
+		free(mod->scratch_buf);
+		mod->scratch_buf = malloc(size);
+		REMODULE_ASSERT(mod->scratch_buf != NULL, "Could not allocate scratch buffer");
+		mod->scratch_size = size;
+	}
+
+	return mod->scratch_buf;
+}
+
+static size_t
+remodule_index_capacity(size_t num_entries) {
+	// Keep the load factor at or below 0.5
+	size_t capacity = 1;
+	while (capacity < num_entries * 2) { capacity <<= 1; }
+	return capacity;
+}
+
+static void
+remodule_index_build(
+	uint32_t* slots,
+	size_t capacity,
+	const remodule_tmp_var_storage_t* entries,
+	size_t num_entries
+) {
+	// A slot holds an entry index + 1 so that 0 means empty
+	memset(slots, 0, capacity * sizeof(uint32_t));
+	size_t mask = capacity - 1;
+	for (size_t i = 0; i < num_entries; ++i) {
+		size_t slot = entries[i].hash & mask;
+		while (slots[slot] != 0) { slot = (slot + 1) & mask; }
+		slots[slot] = (uint32_t)(i + 1);
+	}
+}
+
+static const remodule_tmp_var_storage_t*
+remodule_index_find(
+	const uint32_t* slots,
+	size_t capacity,
+	const remodule_tmp_var_storage_t* entries,
+	const char* name,
+	size_t name_length,
+	uint32_t hash
+) {
+	size_t mask = capacity - 1;
+	for (
+		size_t slot = hash & mask;
+		slots[slot] != 0;
+		slot = (slot + 1) & mask
+	) {
+		const remodule_tmp_var_storage_t* entry = &entries[slots[slot] - 1];
+		if (
+			entry->hash == hash
+			&& entry->name_length == name_length
+			&& memcmp(entry->name, name, name_length) == 0
+		) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static bool
+remodule_field_equal(const remodule_field_info_t* lhs, const remodule_field_info_t* rhs) {
+	return lhs->size == rhs->size
+		&& lhs->name_length == rhs->name_length
+		&& lhs->type_name_length == rhs->type_name_length
+		&& memcmp(lhs->name, rhs->name, lhs->name_length) == 0
+		&& memcmp(lhs->type_name, rhs->type_name, lhs->type_name_length) == 0;
+}
+
+static bool
+remodule_layout_changed(
+	const remodule_var_info_t* var,
+	const remodule_tmp_var_storage_t* storage
+) {
+	if (var->value_size != storage->value_size) { return true; }
+	// Without a layout on both sides, only the size can be compared
+	if (var->fields == NULL || storage->fields == NULL) { return false; }
+	if (var->num_fields != storage->num_fields) { return true; }
+
+	for (size_t i = 0; i < var->num_fields; ++i) {
+		if (
+			var->fields[i].offset != storage->fields[i].offset
+			|| !remodule_field_equal(&var->fields[i], &storage->fields[i])
+		) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool
+remodule_migrate_var(
+	const remodule_var_info_t* var,
+	const remodule_tmp_var_storage_t* storage
+) {
+	if (var->migrate == NULL && (var->fields == NULL || storage->fields == NULL)) {
+		return false;
+	}
+
+	if (var->fields != NULL && storage->fields != NULL) {
+		for (size_t i = 0; i < var->num_fields; ++i) {
+			const remodule_field_info_t* field = &var->fields[i];
+
+			// Fields are usually kept in order so try the same position first
+			const remodule_field_info_t* old_field = NULL;
+			if (i < storage->num_fields && remodule_field_equal(field, &storage->fields[i])) {
+				old_field = &storage->fields[i];
+			} else {
+				for (size_t j = 0; j < storage->num_fields; ++j) {
+					if (remodule_field_equal(field, &storage->fields[j])) {
+						old_field = &storage->fields[j];
+						break;
+					}
+				}
+			}
+
+			if (old_field != NULL) {
+				memcpy(
+					(char*)var->value_addr + field->offset,
+					(const char*)storage->value + old_field->offset,
+					field->size
+				);
+			}
+		}
+	}
+
+	if (var->migrate != NULL) {
+		var->migrate(var->value_addr, var->value_size, storage->value, storage->value_size);
+	}
+
+	return true;
+}
+
+static void
+remodule_restore_vars(
+	remodule_stats_t* stats,
+	remodule_var_table_t* table,
+	uint32_t* index_slots,
+	size_t index_capacity,
+	const remodule_tmp_var_storage_t* entries,
+	size_t num_entries
+) {
+	size_t num_matched = 0;
+	size_t num_migrated = 0;
+	size_t num_size_mismatched = 0;
+
+	remodule_index_build(index_slots, index_capacity, entries, num_entries);
+	for (size_t i = 0; i < table->num_vars; ++i) {
+		remodule_var_t* var = &table->vars[i];
+		var->restored = false;
+		const remodule_tmp_var_storage_t* storage = remodule_index_find(
+			index_slots, index_capacity, entries,
+			var->info->name, var->info->name_length, var->hash
+		);
+		if (storage == NULL) { continue; }
+
+		if (!remodule_layout_changed(var->info, storage)) {
+			memcpy(var->info->value_addr, storage->value, storage->value_size);
+			var->restored = true;
+			++num_matched;
+		} else if (remodule_migrate_var(var->info, storage)) {
+			var->restored = true;
+			++num_matched;
+			++num_migrated;
+		} else {
+			++num_size_mismatched;
+		}
+	}
+
+	stats->num_vars_matched = num_matched;
+	stats->num_vars_migrated = num_migrated;
+	stats->num_vars_size_mismatched = num_size_mismatched;
+	stats->num_vars_dropped = num_entries - num_matched - num_size_mismatched;
+}
+
+static uintptr_t
+remodule_var_addr(const remodule_var_info_t* var) {
+	return var->fn_addr != NULL ? (uintptr_t)var->fn_addr : (uintptr_t)var->value_addr;
+}
+
+static int
+remodule_anchor_compare(const void* lhs, const void* rhs) {
+	uintptr_t a = ((const remodule_anchor_t*)lhs)->addr;
+	uintptr_t b = ((const remodule_anchor_t*)rhs)->addr;
+	return (a > b) - (a < b);
+}
+
+static void
+remodule_collect_anchors(remodule_t* mod, const remodule_var_table_t* table, bool copy_names) {
+	mod->num_old_anchors = 0;
+	// Nothing in the old instance asked for relocation
+	if (table->num_pointer_fields == 0 && table->num_relocatables == 0) { return; }
+
+	size_t num_anchors = table->num_vars + table->num_relocatables;
+	if (num_anchors > mod->old_anchor_capacity) {
+		free(mod->old_anchors);
+		mod->old_anchors = malloc(num_anchors * sizeof(remodule_anchor_t));
+		mod->old_anchor_capacity = num_anchors;
+	}
+
+	size_t names_size = 0;
+	if (copy_names) {
+		for (size_t i = 0; i < table->num_vars; ++i) {
+			names_size += table->vars[i].info->name_length;
+		}
+		for (size_t i = 0; i < table->num_relocatables; ++i) {
+			names_size += table->relocatables[i].info->name_length;
+		}
+		if (names_size > mod->old_anchor_names_capacity) {
+			free(mod->old_anchor_names);
+			mod->old_anchor_names = malloc(names_size);
+			mod->old_anchor_names_capacity = names_size;
+		}
+	}
+
+	char* name_ptr = mod->old_anchor_names;
+	for (size_t i = 0; i < num_anchors; ++i) {
+		const remodule_var_t* var = i < table->num_vars
+			? &table->vars[i]
+			: &table->relocatables[i - table->num_vars];
+
+		const char* name = var->info->name;
+		if (copy_names) {
+			memcpy(name_ptr, name, var->info->name_length);
+			name = name_ptr;
+			name_ptr += var->info->name_length;
+		}
+
+		mod->old_anchors[i] = (remodule_anchor_t){
+			.name = name,
+			.name_length = var->info->name_length,
+			.addr = remodule_var_addr(var->info),
+			.size = var->info->value_size,
+			.hash = var->hash,
+		};
+	}
+	mod->num_old_anchors = num_anchors;
+
+	qsort(mod->old_anchors, num_anchors, sizeof(remodule_anchor_t), remodule_anchor_compare);
+}
+
+static const remodule_anchor_t*
+remodule_find_old_anchor(const remodule_t* mod, uintptr_t addr) {
+	// Find the last anchor starting at or before addr
+	size_t begin = 0;
+	size_t end = mod->num_old_anchors;
+	while (begin < end) {
+		size_t mid = begin + (end - begin) / 2;
+		if (mod->old_anchors[mid].addr <= addr) {
+			begin = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+
+	if (begin == 0) { return NULL; }
+
+	const remodule_anchor_t* anchor = &mod->old_anchors[begin - 1];
+	return addr - anchor->addr < anchor->size ? anchor : NULL;
+}
+
+static void
+remodule_relocate_pointers(remodule_t* mod, const remodule_var_table_t* table) {
+	mod->stats.num_pointers_relocated = 0;
+	mod->stats.num_pointers_unresolved = 0;
+	if (mod->num_old_anchors == 0 || table->num_pointer_fields == 0) { return; }
+
+	// Index where everything is in the new instance
+	size_t num_entries = table->num_vars + table->num_relocatables;
+	size_t index_capacity = remodule_index_capacity(num_entries);
+	char* tmp_buf = remodule_scratch(
+		mod,
+		num_entries * sizeof(remodule_tmp_var_storage_t)
+		+ index_capacity * sizeof(uint32_t)
+	);
+	remodule_tmp_var_storage_t* entries = (remodule_tmp_var_storage_t*)tmp_buf;
+	uint32_t* index_slots = (uint32_t*)(entries + num_entries);
+	for (size_t i = 0; i < num_entries; ++i) {
+		const remodule_var_t* var = i < table->num_vars
+			? &table->vars[i]
+			: &table->relocatables[i - table->num_vars];
+
+		entries[i] = (remodule_tmp_var_storage_t){
+			.name = (char*)var->info->name,
+			.name_length = var->info->name_length,
+			.value = (void*)remodule_var_addr(var->info),
+			.value_size = var->info->value_size,
+			.hash = var->hash,
+		};
+	}
+	remodule_index_build(index_slots, index_capacity, entries, num_entries);
+
+	for (size_t i = 0; i < table->num_vars; ++i) {
+		const remodule_var_t* var = &table->vars[i];
+		if (!var->restored) { continue; }
+
+		for (size_t j = 0; j < var->info->num_fields; ++j) {
+			const remodule_field_info_t* field = &var->info->fields[j];
+			if ((field->flags & REMODULE_FIELD_FLAG_POINTER) == 0) { continue; }
+
+			for (
+				size_t offset = field->offset;
+				offset + sizeof(uintptr_t) <= field->offset + field->size;
+				offset += sizeof(uintptr_t)
+			) {
+				char* slot = (char*)var->info->value_addr + offset;
+				uintptr_t ptr;
+				memcpy(&ptr, slot, sizeof(ptr));
+				if (ptr == 0) { continue; }
+
+				const remodule_anchor_t* old_anchor = remodule_find_old_anchor(mod, ptr);
+				if (old_anchor == NULL) { continue; }
+
+				const remodule_tmp_var_storage_t* new_anchor = remodule_index_find(
+					index_slots, index_capacity, entries,
+					old_anchor->name, old_anchor->name_length, old_anchor->hash
+				);
+				uintptr_t delta = ptr - old_anchor->addr;
+				if (new_anchor != NULL && delta < new_anchor->value_size) {
+					ptr = (uintptr_t)new_anchor->value + delta;
+					++mod->stats.num_pointers_relocated;
+				} else {
+					ptr = 0;
+					++mod->stats.num_pointers_unresolved;
+				}
+				memcpy(slot, &ptr, sizeof(ptr));
+			}
+		}
+	}
+}
+
+static remodule_fn_t
+remodule_find_function(const remodule_var_table_t* table, const remodule_function_t* function) {
+	for (size_t i = 0; i < table->num_relocatables; ++i) {
+		const remodule_var_t* var = &table->relocatables[i];
+		if (
+			(var->info->flags & REMODULE_VAR_FLAG_EXPORTED) != 0
+			&& var->hash == function->hash
+			&& var->info->name_length == function->name_length
+			&& memcmp(var->info->name, function->name, function->name_length) == 0
+		) {
+			return var->info->fn_addr;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+remodule_bind_exports(remodule_t* mod, const remodule_var_table_t* table) {
+	if (table->num_exports > mod->exports_capacity) {
+		// The outgrown table is kept, and updated, for hosts still reading it
+		if (mod->exports != NULL) {
+			mod->old_exports = realloc(
+				mod->old_exports,
+				(mod->num_old_exports + 1) * sizeof(remodule_export_table_t)
+			);
+			mod->old_exports[mod->num_old_exports++] = (remodule_export_table_t){
+				.entries = mod->exports,
+				.capacity = mod->exports_capacity,
+			};
+		}
+
+		// Doubled so that few tables are ever kept
+		size_t capacity = mod->exports_capacity * 2;
+		if (capacity < table->num_exports) { capacity = table->num_exports; }
+		mod->exports = calloc(capacity, sizeof(remodule_export_t));
+		mod->exports_capacity = capacity;
+	}
+	if (mod->exports_capacity == 0) { return; }
+
+	// Built aside so that an entry that is still exported is never seen cleared
+	remodule_export_t* exports = remodule_scratch(mod, mod->exports_capacity * sizeof(remodule_export_t));
+	memset(exports, 0, mod->exports_capacity * sizeof(remodule_export_t));
+	for (size_t i = 0; i < table->num_relocatables; ++i) {
+		const remodule_var_info_t* var = table->relocatables[i].info;
+		if ((var->flags & REMODULE_VAR_FLAG_INDEXED) == 0) { continue; }
+
+		if (var->fn_addr != NULL) {
+			exports[var->export_id].fn = var->fn_addr;
+		} else {
+			exports[var->export_id].data = var->value_addr;
+		}
+	}
+
+	for (size_t i = 0; i < mod->exports_capacity; ++i) {
+		remodule_atomic_export_store(&mod->exports[i], exports[i]);
+	}
+	for (size_t i = 0; i < mod->num_old_exports; ++i) {
+		remodule_export_table_t* old = &mod->old_exports[i];
+		for (size_t j = 0; j < old->capacity; ++j) {
+			remodule_atomic_export_store(&old->entries[j], exports[j]);
+		}
+	}
+	mod->num_exports = table->num_exports;
+}
+
+static void
+remodule_clear_exports(remodule_t* mod) {
+	remodule_export_t cleared = { .data = NULL };
+	for (size_t i = 0; i < mod->exports_capacity; ++i) {
+		remodule_atomic_export_store(&mod->exports[i], cleared);
+	}
+	for (size_t i = 0; i < mod->num_old_exports; ++i) {
+		remodule_export_table_t* old = &mod->old_exports[i];
+		for (size_t j = 0; j < old->capacity; ++j) {
+			remodule_atomic_export_store(&old->entries[j], cleared);
+		}
+	}
+}
+
+static void
+remodule_retarget_functions(remodule_t* mod, const remodule_var_table_t* table) {
+	if (mod->num_functions == 0) { return; }
+
+	// Index the exports of the new instance
+	size_t num_exports = table->num_relocatables;
+	size_t index_capacity = remodule_index_capacity(num_exports);
+	char* tmp_buf = remodule_scratch(
+		mod,
+		num_exports * sizeof(remodule_tmp_var_storage_t)
+		+ index_capacity * sizeof(uint32_t)
+	);
+	remodule_tmp_var_storage_t* entries = (remodule_tmp_var_storage_t*)tmp_buf;
+	uint32_t* index_slots = (uint32_t*)(entries + num_exports);
+	for (size_t i = 0; i < num_exports; ++i) {
+		const remodule_var_t* var = &table->relocatables[i];
+		entries[i] = (remodule_tmp_var_storage_t){
+			.name = (char*)var->info->name,
+			.name_length = var->info->name_length,
+			.value = (void*)var->info,
+			.hash = var->hash,
+		};
+	}
+	remodule_index_build(index_slots, index_capacity, entries, num_exports);
+
+	for (size_t i = 0; i < mod->num_functions; ++i) {
+		remodule_function_t* function = mod->functions[i];
+		const remodule_tmp_var_storage_t* entry = remodule_index_find(
+			index_slots, index_capacity, entries,
+			function->name, function->name_length, function->hash
+		);
+		const remodule_var_info_t* var = entry != NULL ? entry->value : NULL;
+		remodule_atomic_fn_store(
+			&function->fn,
+			var != NULL && (var->flags & REMODULE_VAR_FLAG_EXPORTED) != 0 ? var->fn_addr : NULL
+		);
+	}
+}
+
+static void
+remodule_clear_functions(remodule_t* mod) {
+	for (size_t i = 0; i < mod->num_functions; ++i) {
+		remodule_atomic_fn_store(&mod->functions[i]->fn, NULL);
+	}
+}
+
+static void
+remodule_bind_host_vars(remodule_t* mod, const remodule_var_table_t* table) {
+	size_t num_storage = mod->num_host_storage;
+	size_t index_capacity = remodule_index_capacity(num_storage);
+	char* tmp_buf = remodule_scratch(
+		mod,
+		index_capacity * sizeof(uint32_t) + num_storage * sizeof(bool)
+	);
+	uint32_t* index_slots = (uint32_t*)tmp_buf;
+	bool* bound = (bool*)(index_slots + index_capacity);
+	memset(bound, 0, num_storage * sizeof(bool));
+	remodule_index_build(index_slots, index_capacity, mod->host_storage, num_storage);
+
+	for (size_t i = 0; i < table->num_host_vars; ++i) {
+		const remodule_var_t* var = &table->host_vars[i];
+		const remodule_tmp_var_storage_t* storage = remodule_index_find(
+			index_slots, index_capacity, mod->host_storage,
+			var->info->name, var->info->name_length, var->hash
+		);
+
+		if (
+			storage != NULL
+			&& storage->value_size == var->info->value_size
+			&& storage->value_align == var->info->value_align
+		) {
+			bound[storage - mod->host_storage] = true;
+			*(void**)var->info->value_addr = storage->value;
+			continue;
+		}
+
+		// New or incompatible, a mismatched entry is released below
+		if (mod->num_host_storage == mod->host_storage_capacity) {
+			mod->host_storage_capacity = mod->host_storage_capacity > 0 ? mod->host_storage_capacity * 2 : 8;
+			mod->host_storage = realloc(
+				mod->host_storage,
+				mod->host_storage_capacity * sizeof(remodule_tmp_var_storage_t)
+			);
+		}
+
+		void* value = remodule_aligned_alloc(var->info->value_size, var->info->value_align);
+		REMODULE_ASSERT(value != NULL, "Could not allocate host var");
+		char* name = malloc(var->info->name_length);
+		memcpy(name, var->info->name, var->info->name_length);
+
+		mod->host_storage[mod->num_host_storage++] = (remodule_tmp_var_storage_t){
+			.name = name,
+			.name_length = var->info->name_length,
+			.value = value,
+			.value_size = var->info->value_size,
+			.value_align = var->info->value_align,
+			.hash = var->hash,
+		};
+		*(void**)var->info->value_addr = value;
+	}
+
+	// Drop storage that the instance no longer declares.
+	// The old instance can still be running, see remodule_release_old_lib.
+	size_t num_kept = 0;
+	for (size_t i = 0; i < mod->num_host_storage; ++i) {
+		remodule_tmp_var_storage_t* storage = &mod->host_storage[i];
+		if (i < num_storage && !bound[i]) {
+			if (mod->num_dropped_host_storage == mod->dropped_host_storage_capacity) {
+				mod->dropped_host_storage_capacity = mod->dropped_host_storage_capacity > 0
+					? mod->dropped_host_storage_capacity * 2
+					: 4;
+				mod->dropped_host_storage = realloc(
+					mod->dropped_host_storage,
+					mod->dropped_host_storage_capacity * sizeof(remodule_tmp_var_storage_t)
+				);
+			}
+			mod->dropped_host_storage[mod->num_dropped_host_storage++] = *storage;
+		} else {
+			mod->host_storage[num_kept++] = *storage;
+		}
+	}
+	mod->num_host_storage = num_kept;
+}
+
+static void
+remodule_free_host_storage(remodule_tmp_var_storage_t* storage, size_t num_storage) {
+	for (size_t i = 0; i < num_storage; ++i) {
+		free(storage[i].name);
+		remodule_aligned_free(storage[i].value);
+	}
+}
+
+#define REMODULE_SNAPSHOT_MAGIC "RMSNAP\0\0"
+#define REMODULE_SNAPSHOT_VERSION 1
+#define REMODULE_SNAPSHOT_BYTE_ORDER 0x01020304u
+#define REMODULE_SNAPSHOT_VALUE_ALIGNMENT 16
+
+// All offsets are from the start of the file
+typedef struct remodule_snapshot_header_s {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t pointer_size;
+	uint32_t page_size;
+	uint64_t num_vars;
+	uint64_t file_size;
+} remodule_snapshot_header_t;
+
+typedef struct remodule_snapshot_entry_s {
+	uint64_t name_offset;
+	uint64_t name_length;
+	uint64_t value_offset;
+	uint64_t value_size;
+} remodule_snapshot_entry_t;
+
+static uint64_t
+remodule_snapshot_align(uint64_t offset, uint64_t value_size, uint64_t page_size) {
+	// Large values are page-aligned so they can be mapped in place
+	uint64_t alignment = value_size >= page_size ? page_size : REMODULE_SNAPSHOT_VALUE_ALIGNMENT;
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+static bool
+remodule_snapshot_write_padding(FILE* file, uint64_t* offset, uint64_t target) {
+	static const char zeros[REMODULE_SNAPSHOT_VALUE_ALIGNMENT] = { 0 };
+	while (*offset < target) {
+		uint64_t size = target - *offset;
+		if (size > sizeof(zeros)) { size = sizeof(zeros); }
+		if (fwrite(zeros, 1, (size_t)size, file) != size) { return false; }
+		*offset += size;
+	}
+
+	return true;
+}
+
+bool
+remodule_save_snapshot(remodule_t* mod) {
+	if (mod->snapshot_path == NULL) { return false; }
+
+	const remodule_var_table_t* table = &mod->vars;
+	uint64_t page_size = remodule_page_size();
+
+	// Lay out the file
+	remodule_snapshot_entry_t* entries = remodule_scratch(
+		mod,
+		table->num_vars * sizeof(remodule_snapshot_entry_t)
+	);
+	uint64_t offset = sizeof(remodule_snapshot_header_t)
+		+ table->num_vars * sizeof(remodule_snapshot_entry_t);
+	for (size_t i = 0; i < table->num_vars; ++i) {
+		const remodule_var_info_t* var = table->vars[i].info;
+		entries[i].name_offset = offset;
+		entries[i].name_length = var->name_length;
+		offset += var->name_length;
+	}
+	uint64_t names_end = offset;
+	for (size_t i = 0; i < table->num_vars; ++i) {
+		const remodule_var_info_t* var = table->vars[i].info;
+		offset = remodule_snapshot_align(offset, var->value_size, page_size);
+		entries[i].value_offset = offset;
+		entries[i].value_size = var->value_size;
+		offset += var->value_size;
+	}
+
+	remodule_snapshot_header_t header = {
+		.magic = REMODULE_SNAPSHOT_MAGIC,
+		.version = REMODULE_SNAPSHOT_VERSION,
+		.byte_order = REMODULE_SNAPSHOT_BYTE_ORDER,
+		.pointer_size = sizeof(void*),
+		.page_size = (uint32_t)page_size,
+		.num_vars = table->num_vars,
+		.file_size = offset,
+	};
+
+	// Write to a temporary file and swap it in so readers never see a partial snapshot.
+	// Its name is unique so that writers sharing the path do not mix their files.
+	size_t path_len = strlen(mod->snapshot_path);
+	char* tmp_path = malloc(path_len + sizeof(".XXXXXX"));
+	memcpy(tmp_path, mod->snapshot_path, path_len);
+	memcpy(tmp_path + path_len, ".XXXXXX", sizeof(".XXXXXX"));
+
+	FILE* file = remodule_create_temp_file(tmp_path);
+	if (file == NULL) {
+		free(tmp_path);
+		return false;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& (table->num_vars == 0 || fwrite(entries, sizeof(entries[0]), table->num_vars, file) == table->num_vars);
+	for (size_t i = 0; ok && i < table->num_vars; ++i) {
+		const remodule_var_info_t* var = table->vars[i].info;
+		ok = fwrite(var->name, 1, var->name_length, file) == var->name_length;
+	}
+	offset = names_end;
+	for (size_t i = 0; ok && i < table->num_vars; ++i) {
+		const remodule_var_info_t* var = table->vars[i].info;
+		ok = remodule_snapshot_write_padding(file, &offset, entries[i].value_offset)
+			&& fwrite(var->value_addr, 1, var->value_size, file) == var->value_size;
+		offset += var->value_size;
+	}
+	ok = fclose(file) == 0 && ok;
+
+	ok = ok && remodule_replace_file(tmp_path, mod->snapshot_path);
+	if (!ok) { remove(tmp_path); }
+	free(tmp_path);
+
+	return ok;
+}
+
+static void
+remodule_load_snapshot(remodule_t* mod) {
+	remodule_mapping_t mapping;
+	if (!remodule_mapping_open(&mapping, mod->snapshot_path)) { return; }
+
+	// Validate before trusting any offset
+	const char* data = mapping.data;
+	const remodule_snapshot_header_t* header = mapping.data;
+	bool valid = mapping.size >= sizeof(remodule_snapshot_header_t)
+		&& memcmp(header->magic, REMODULE_SNAPSHOT_MAGIC, sizeof(header->magic)) == 0
+		&& header->version == REMODULE_SNAPSHOT_VERSION
+		&& header->byte_order == REMODULE_SNAPSHOT_BYTE_ORDER
+		&& header->pointer_size == sizeof(void*)
+		&& header->file_size == mapping.size
+		&& header->num_vars <= (mapping.size - sizeof(remodule_snapshot_header_t)) / sizeof(remodule_snapshot_entry_t);
+	const remodule_snapshot_entry_t* file_entries = (const remodule_snapshot_entry_t*)(header + 1);
+	for (uint64_t i = 0; valid && i < header->num_vars; ++i) {
+		const remodule_snapshot_entry_t* entry = &file_entries[i];
+		valid = entry->name_offset <= mapping.size
+			&& entry->name_length <= mapping.size - entry->name_offset
+			&& entry->value_offset <= mapping.size
+			&& entry->value_size <= mapping.size - entry->value_offset;
+	}
+	if (!valid) {
+		remodule_mapping_close(&mapping);
+		return;
+	}
+
+	size_t num_entries = (size_t)header->num_vars;
+	size_t index_capacity = remodule_index_capacity(num_entries);
+	char* tmp_buf = remodule_scratch(
+		mod,
+		num_entries * sizeof(remodule_tmp_var_storage_t)
+		+ index_capacity * sizeof(uint32_t)
+	);
+	remodule_tmp_var_storage_t* entries = (remodule_tmp_var_storage_t*)tmp_buf;
+	uint32_t* index_slots = (uint32_t*)(entries + num_entries);
+
+	for (size_t i = 0; i < num_entries; ++i) {
+		const remodule_snapshot_entry_t* entry = &file_entries[i];
+		entries[i] = (remodule_tmp_var_storage_t){
+			.name = (char*)data + entry->name_offset,
+			.name_length = (size_t)entry->name_length,
+			.value = (char*)data + entry->value_offset,
+			.value_size = (size_t)entry->value_size,
+			.hash = remodule_hash(data + entry->name_offset, (size_t)entry->name_length),
+		};
+	}
+
+	size_t page_size = remodule_page_size();
+	size_t num_matched = 0;
+	size_t num_size_mismatched = 0;
+	remodule_index_build(index_slots, index_capacity, entries, num_entries);
+	for (size_t i = 0; i < mod->vars.num_vars; ++i) {
+		const remodule_var_t* var = &mod->vars.vars[i];
+		const remodule_tmp_var_storage_t* storage = remodule_index_find(
+			index_slots, index_capacity, entries,
+			var->info->name, var->info->name_length, var->hash
+		);
+		if (storage == NULL) { continue; }
+
+		if (storage->value_size != var->info->value_size) {
+			++num_size_mismatched;
+			continue;
+		}
+		++num_matched;
+
+		// Map whole pages when both sides are page-aligned, copy the rest
+		size_t value_offset = (size_t)((const char*)storage->value - data);
+		size_t num_mapped = 0;
+		if (
+			(uintptr_t)var->info->value_addr % page_size == 0
+			&& value_offset % page_size == 0
+			&& storage->value_size >= page_size
+		) {
+			size_t num_pages_bytes = storage->value_size / page_size * page_size;
+			if (remodule_mapping_map_pages(&mapping, value_offset, var->info->value_addr, num_pages_bytes)) {
+				num_mapped = num_pages_bytes;
+			}
+		}
+
+		memcpy(
+			(char*)var->info->value_addr + num_mapped,
+			(const char*)storage->value + num_mapped,
+			storage->value_size - num_mapped
+		);
+	}
+
+	mod->stats.num_vars_matched = num_matched;
+	mod->stats.num_vars_migrated = 0;
+	mod->stats.num_vars_size_mismatched = num_size_mismatched;
+	mod->stats.num_vars_dropped = num_entries - num_matched - num_size_mismatched;
+
+	remodule_mapping_close(&mapping);
+}
+
+remodule_t*
+remodule_load(const char* path, void* userdata) {
+	return remodule_load_ex(path, userdata, NULL);
+}
+
+static void*
+remodule_bump_alloc(remodule_bump_t* bump, size_t size, size_t align) {
+	if (align == 0) { align = REMODULE_MAX_ALIGN; }
+	if ((align & (align - 1)) != 0) { return NULL; }
+
+	uintptr_t addr = ((uintptr_t)bump->ptr + align - 1) & ~(uintptr_t)(align - 1);
+	if (
+		bump->ptr != NULL
+		&& addr <= (uintptr_t)bump->end
+		&& size <= (uintptr_t)bump->end - addr
+	) {
+		bump->ptr = (char*)(addr + size);
+		return (void*)addr;
+	}
+
+	size_t chunk_size = bump->min_chunk_size > REMODULE_CHUNK_SIZE
+		? bump->min_chunk_size
+		: REMODULE_CHUNK_SIZE;
+	size_t required_size = sizeof(remodule_chunk_t) + align + size;
+	if (required_size < size) { return NULL; }
+	// Do not waste the current chunk on an oversized allocation
+	bool dedicated = required_size > chunk_size / 4;
+	if (required_size > chunk_size) { chunk_size = required_size; }
+
+	remodule_chunk_t* chunk = calloc(1, chunk_size);
+	if (chunk == NULL) { return NULL; }
+	chunk->size = chunk_size;
+	bump->reserved += chunk_size;
+	bump->min_chunk_size = 0;
+
+	char* begin = (char*)(chunk + 1);
+	char* end = (char*)chunk + chunk_size;
+	addr = ((uintptr_t)begin + align - 1) & ~(uintptr_t)(align - 1);
+	if (dedicated && bump->chunks != NULL) {
+		chunk->next = bump->chunks->next;
+		bump->chunks->next = chunk;
+	} else {
+		chunk->next = bump->chunks;
+		bump->chunks = chunk;
+		bump->ptr = (char*)(addr + size);
+		bump->end = end;
+	}
+
+	return (void*)addr;
+}
+
+static void
+remodule_bump_free_all(remodule_bump_t* bump) {
+	for (remodule_chunk_t* chunk = bump->chunks; chunk != NULL;) {
+		remodule_chunk_t* next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	bump->chunks = NULL;
+	bump->ptr = bump->end = NULL;
+	bump->reserved = 0;
+}
+
+static void
+remodule_bump_reset(remodule_bump_t* bump) {
+	if (bump->chunks == NULL) { return; }
+
+	if (bump->chunks->next != NULL) {
+		// Get one chunk that fits everything on the next allocation
+		size_t reserved = bump->reserved;
+		remodule_bump_free_all(bump);
+		bump->min_chunk_size = reserved;
+	} else {
+		bump->ptr = (char*)(bump->chunks + 1);
+	}
+}
+
+static int
+remodule_pool_class(size_t size) {
+	int size_class = 0;
+	for (
+		size_t class_size = REMODULE_POOL_MIN_SIZE;
+		class_size < size;
+		class_size <<= 1
+	) {
+		if (++size_class == REMODULE_POOL_NUM_CLASSES) { return -1; }
+	}
+
+	return size_class;
+}
+
+void*
+remodule_arena_alloc(remodule_t* mod, size_t size, size_t align) {
+	void* ptr = remodule_bump_alloc(&mod->arena, size, align);
+	if (ptr != NULL) { mod->stats.memory.arena_used += size; }
+	mod->stats.memory.arena_reserved = mod->arena.reserved;
+	return ptr;
+}
+
+void*
+remodule_pool_alloc(remodule_t* mod, size_t size) {
+	remodule_memory_usage_t* usage = &mod->stats.memory;
+	int size_class = remodule_pool_class(size);
+
+	if (size_class < 0) {
+		remodule_large_block_t* block = malloc(sizeof(remodule_large_block_t) + size);
+		if (block == NULL) { return NULL; }
+
+		block->link.prev = NULL;
+		block->link.next = mod->large_blocks;
+		if (mod->large_blocks != NULL) { mod->large_blocks->link.prev = block; }
+		mod->large_blocks = block;
+
+		usage->pool_reserved += sizeof(remodule_large_block_t) + size;
+		usage->pool_used += size;
+		return block + 1;
+	}
+
+	size_t class_size = (size_t)REMODULE_POOL_MIN_SIZE << size_class;
+	void* ptr = mod->pool_free_lists[size_class];
+	if (ptr != NULL) {
+		memcpy(&mod->pool_free_lists[size_class], ptr, sizeof(void*));
+	} else {
+		size_t align = class_size < REMODULE_MAX_ALIGN ? class_size : REMODULE_MAX_ALIGN;
+		size_t old_reserved = mod->pool_arena.reserved;
+		ptr = remodule_bump_alloc(&mod->pool_arena, class_size, align);
+		if (ptr == NULL) { return NULL; }
+		usage->pool_reserved += mod->pool_arena.reserved - old_reserved;
+	}
+
+	usage->pool_used += class_size;
+	return ptr;
+}
+
+void
+remodule_pool_free(remodule_t* mod, void* ptr, size_t size) {
+	if (ptr == NULL) { return; }
+
+	remodule_memory_usage_t* usage = &mod->stats.memory;
+	int size_class = remodule_pool_class(size);
+
+	if (size_class < 0) {
+		remodule_large_block_t* block = (remodule_large_block_t*)ptr - 1;
+		if (block->link.prev != NULL) {
+			block->link.prev->link.next = block->link.next;
+		} else {
+			mod->large_blocks = block->link.next;
+		}
+		if (block->link.next != NULL) { block->link.next->link.prev = block->link.prev; }
+		free(block);
+
+		usage->pool_reserved -= sizeof(remodule_large_block_t) + size;
+		usage->pool_used -= size;
+		return;
+	}
+
+	memcpy(ptr, &mod->pool_free_lists[size_class], sizeof(void*));
+	mod->pool_free_lists[size_class] = ptr;
+	usage->pool_used -= (size_t)REMODULE_POOL_MIN_SIZE << size_class;
+}
+
+void*
+remodule_frame_alloc(remodule_t* mod, size_t size, size_t align) {
+	remodule_memory_usage_t* usage = &mod->stats.memory;
+	void* ptr = remodule_bump_alloc(&mod->frame, size, align);
+	if (ptr != NULL) {
+		usage->frame_used += size;
+		if (usage->frame_used > usage->frame_peak) { usage->frame_peak = usage->frame_used; }
+	}
+	usage->frame_reserved = mod->frame.reserved;
+	return ptr;
+}
+
+void
+remodule_frame_reset(remodule_t* mod) {
+	remodule_bump_reset(&mod->frame);
+	mod->stats.memory.frame_used = 0;
+	mod->stats.memory.frame_reserved = mod->frame.reserved;
+}
+
+static void
+remodule_free_allocators(remodule_t* mod) {
+	remodule_bump_free_all(&mod->arena);
+	remodule_bump_free_all(&mod->pool_arena);
+	remodule_bump_free_all(&mod->frame);
+	for (remodule_large_block_t* block = mod->large_blocks; block != NULL;) {
+		remodule_large_block_t* next = block->link.next;
+		free(block);
+		block = next;
+	}
+}
+
+void
+remodule_publish(remodule_t* mod, void* interface) {
+	remodule_atomic_ptr_store(&mod->published, interface);
+}
+
+remodule_reader_t*
+remodule_register_reader(remodule_t* mod) {
+	// Reuse an unregistered reader
+	for (
+		remodule_reader_t* reader = remodule_atomic_ptr_load(&mod->readers);
+		reader != NULL;
+		reader = reader->next
+	) {
+		if (remodule_atomic_cas(&reader->in_use, 0, 1)) { return reader; }
+	}
+
+	// Keep readers on separate cache lines
+	size_t reader_size = sizeof(remodule_reader_t) > REMODULE_CACHE_LINE_SIZE
+		? sizeof(remodule_reader_t)
+		: REMODULE_CACHE_LINE_SIZE;
+	remodule_reader_t* reader = remodule_aligned_alloc(reader_size, REMODULE_CACHE_LINE_SIZE);
+	REMODULE_ASSERT(reader != NULL, "Could not allocate reader");
+	reader->mod = mod;
+	remodule_atomic_store(&reader->epoch, 0);
+	remodule_atomic_store(&reader->in_use, 1);
+
+	do {
+		reader->next = remodule_atomic_ptr_load(&mod->readers);
+	} while (!remodule_atomic_ptr_cas(&mod->readers, reader->next, reader));
+
+	return reader;
+}
+
+void
+remodule_unregister_reader(remodule_reader_t* reader) {
+	remodule_atomic_store(&reader->epoch, 0);
+	remodule_atomic_store(&reader->in_use, 0);
+}
+
+void*
+remodule_read_lock(remodule_reader_t* reader) {
+	remodule_t* mod = reader->mod;
+	// Must be visible before the interface is read, see remodule_retire_lib
+	remodule_atomic_exchange(&reader->epoch, remodule_atomic_load(&mod->epoch));
+	return remodule_atomic_ptr_load(&mod->published);
+}
+
+void
+remodule_read_unlock(remodule_reader_t* reader) {
+	remodule_atomic_store(&reader->epoch, 0);
+}
+
+static bool
+remodule_has_readers(remodule_t* mod) {
+	return remodule_atomic_ptr_load(&mod->readers) != NULL;
+}
+
+static int
+remodule_advance_epoch(remodule_t* mod) {
+	// Only the thread reloading the module writes this
+	int epoch = remodule_atomic_load(&mod->epoch) + 1;
+	remodule_atomic_exchange(&mod->epoch, epoch);
+	return epoch;
+}
+
+static int
+remodule_oldest_read_epoch(remodule_t* mod) {
+	int oldest_epoch = remodule_atomic_load(&mod->epoch);
+	for (
+		remodule_reader_t* reader = remodule_atomic_ptr_load(&mod->readers);
+		reader != NULL;
+		reader = reader->next
+	) {
+		int epoch = remodule_atomic_load_seq_cst(&reader->epoch);
+		if (epoch != 0 && epoch < oldest_epoch) { oldest_epoch = epoch; }
+	}
+
+	return oldest_epoch;
+}
+
+size_t
+remodule_reclaim(remodule_t* mod) {
+	if (mod->num_retired == 0) { return 0; }
+
+	// An instance retired at epoch E was unpublished before E started so only
+	// read sections from earlier epochs can still be using it
+	int oldest_epoch = remodule_oldest_read_epoch(mod);
+	size_t num_closed = 0;
+	size_t num_kept = 0;
+	for (size_t i = 0; i < mod->num_retired; ++i) {
+		remodule_retired_t retired = mod->retired[i];
+		if (retired.epoch <= oldest_epoch) {
+			remodule_dynlib_close(retired.lib);
+			remodule_free_host_storage(retired.host_storage, retired.num_host_storage);
+			free(retired.host_storage);
+			++num_closed;
+		} else {
+			mod->retired[num_kept++] = retired;
+		}
+	}
+	mod->num_retired = num_kept;
+	mod->stats.num_retired_instances = num_kept;
+
+	return num_closed;
+}
+
+void
+remodule_synchronize(remodule_t* mod) {
+	int epoch = remodule_advance_epoch(mod);
+	while (remodule_oldest_read_epoch(mod) < epoch) {
+		remodule_yield();
+	}
+
+	remodule_reclaim(mod);
+}
+
+remodule_call_counter_t*
+remodule_register_call_counter(remodule_t* mod) {
+	// Reuse an unregistered counter
+	for (
+		remodule_call_counter_slot_t* slot = remodule_atomic_ptr_load(&mod->call_counters);
+		slot != NULL;
+		slot = slot->next
+	) {
+		if (remodule_atomic_cas(&slot->in_use, 0, 1)) {
+			slot->counter.fenced = !remodule_process_barrier_supported();
+			return &slot->counter;
+		}
+	}
+
+	// Keep counters on separate cache lines
+	size_t slot_size = sizeof(remodule_call_counter_slot_t) > REMODULE_CACHE_LINE_SIZE
+		? sizeof(remodule_call_counter_slot_t)
+		: REMODULE_CACHE_LINE_SIZE;
+	remodule_call_counter_slot_t* slot = remodule_aligned_alloc(slot_size, REMODULE_CACHE_LINE_SIZE);
+	REMODULE_ASSERT(slot != NULL, "Could not allocate call counter");
+	remodule_atomic_store(&slot->in_use, 1);
+	// Without a barrier on behalf of every thread, REMODULE_ENTER fences
+	slot->counter.fenced = !remodule_process_barrier_supported();
+
+	do {
+		slot->next = remodule_atomic_ptr_load(&mod->call_counters);
+	} while (!remodule_atomic_ptr_cas(&mod->call_counters, slot->next, slot));
+
+	return &slot->counter;
+}
+
+void
+remodule_unregister_call_counter(remodule_call_counter_t* counter) {
+	remodule_call_counter_slot_t* slot = (remodule_call_counter_slot_t*)counter;
+	remodule_atomic_store(&slot->in_use, 0);
+}
+
+bool
+remodule_drain(remodule_t* mod, int timeout_ms) {
+	uint64_t start_ns = remodule_now_ns();
+	// Makes every REMODULE_ENTER so far visible, see remodule__enter
+	remodule_process_barrier();
+
+	for (
+		remodule_call_counter_slot_t* slot = remodule_atomic_ptr_load(&mod->call_counters);
+		slot != NULL;
+		slot = slot->next
+	) {
+		uint32_t state = remodule_call_counter_load(&slot->counter);
+		if ((state & REMODULE__CALL_DEPTH_MASK) == 0) { continue; }
+
+		// Done once the outermost call returns, even if the thread calls again
+		while (true) {
+			uint32_t current_state = remodule_call_counter_load(&slot->counter);
+			if (
+				(current_state & REMODULE__CALL_DEPTH_MASK) == 0
+				|| (current_state & ~REMODULE__CALL_DEPTH_MASK) != (state & ~REMODULE__CALL_DEPTH_MASK)
+			) {
+				break;
+			}
+
+			if (timeout_ms >= 0 && remodule_now_ns() - start_ns >= (uint64_t)timeout_ms * 1000000ull) {
+				return false;
+			}
+			remodule_yield();
+		}
+	}
+
+	return true;
+}
+
+static void
+remodule_retire_lib(remodule_t* mod, remodule_dynlib_t lib) {
+	// The new interface was published before this
+	int epoch = remodule_advance_epoch(mod);
+
+	// Host storage dropped by the reload goes with the instance that used it
+	remodule_tmp_var_storage_t* host_storage = NULL;
+	size_t num_host_storage = mod->num_dropped_host_storage;
+	if (num_host_storage > 0) {
+		host_storage = malloc(num_host_storage * sizeof(remodule_tmp_var_storage_t));
+		memcpy(host_storage, mod->dropped_host_storage, num_host_storage * sizeof(remodule_tmp_var_storage_t));
+		mod->num_dropped_host_storage = 0;
+	}
+
+	if (mod->num_retired == mod->retired_capacity) {
+		mod->retired_capacity = mod->retired_capacity > 0 ? mod->retired_capacity * 2 : 4;
+		mod->retired = realloc(mod->retired, mod->retired_capacity * sizeof(remodule_retired_t));
+	}
+	mod->retired[mod->num_retired++] = (remodule_retired_t){
+		.lib = lib,
+		.host_storage = host_storage,
+		.num_host_storage = num_host_storage,
+		.epoch = epoch,
+	};
+
+	remodule_reclaim(mod);
+}
+
+static void
+remodule_release_old_lib(remodule_t* mod, remodule_dynlib_t lib, bool retire) {
+	if (retire) {
+		remodule_retire_lib(mod, lib);
+	} else {
+		// Already closed, nothing can use the dropped storage anymore
+		remodule_free_host_storage(mod->dropped_host_storage, mod->num_dropped_host_storage);
+		mod->num_dropped_host_storage = 0;
+	}
+}
+
+// Unlike thread handles, these are never reused
+static REMODULE__THREAD_LOCAL int remodule_thread_id = 0;
+static remodule_atomic_int_t remodule_next_thread_id;
+
+// Every loaded module, for exiting threads to release their storage
+static remodule_mutex_t remodule_tls_mods_mutex = REMODULE_MUTEX_INIT;
+static remodule_t* remodule_tls_mods = NULL;
+
+static void
+remodule_tls_index_insert(remodule_t* mod, size_t entry_index) {
+	size_t mask = mod->tls_index_capacity - 1;
+	size_t slot = mod->tls_storage[entry_index].hash & mask;
+	while (mod->tls_index[slot] != 0) { slot = (slot + 1) & mask; }
+	mod->tls_index[slot] = (uint32_t)(entry_index + 1);
+}
+
+static void
+remodule_tls_rebuild_index(remodule_t* mod) {
+	memset(mod->tls_index, 0, mod->tls_index_capacity * sizeof(uint32_t));
+	for (size_t i = 0; i < mod->num_tls_storage; ++i) {
+		remodule_tls_index_insert(mod, i);
+	}
+}
+
+static void
+remodule_tls_release_thread(int thread_id) {
+	remodule_mutex_lock(&remodule_tls_mods_mutex);
+	for (remodule_t* mod = remodule_tls_mods; mod != NULL; mod = mod->tls_next) {
+		remodule_mutex_lock(&mod->tls_mutex);
+
+		size_t num_kept = 0;
+		for (size_t i = 0; i < mod->num_tls_storage; ++i) {
+			remodule_tls_storage_t* storage = &mod->tls_storage[i];
+			if (storage->thread_id == thread_id) {
+				mod->stats.memory.thread_local_reserved -= storage->value_size;
+				free(storage->name);
+				remodule_aligned_free(storage->value);
+			} else {
+				mod->tls_storage[num_kept++] = *storage;
+			}
+		}
+
+		// Slots hold entry indices, which just moved
+		if (num_kept != mod->num_tls_storage) {
+			mod->num_tls_storage = num_kept;
+			remodule_tls_rebuild_index(mod);
+		}
+
+		remodule_mutex_unlock(&mod->tls_mutex);
+	}
+	remodule_mutex_unlock(&remodule_tls_mods_mutex);
+}
+
+static void
+remodule_tls_link(remodule_t* mod) {
+	remodule_mutex_lock(&remodule_tls_mods_mutex);
+	mod->tls_prev = NULL;
+	mod->tls_next = remodule_tls_mods;
+	if (remodule_tls_mods != NULL) { remodule_tls_mods->tls_prev = mod; }
+	remodule_tls_mods = mod;
+	remodule_mutex_unlock(&remodule_tls_mods_mutex);
+}
+
+static void
+remodule_tls_unlink(remodule_t* mod) {
+	remodule_mutex_lock(&remodule_tls_mods_mutex);
+	if (mod->tls_prev != NULL) {
+		mod->tls_prev->tls_next = mod->tls_next;
+	} else {
+		remodule_tls_mods = mod->tls_next;
+	}
+	if (mod->tls_next != NULL) { mod->tls_next->tls_prev = mod->tls_prev; }
+	remodule_mutex_unlock(&remodule_tls_mods_mutex);
+}
+
+static void*
+remodule_tls_bind(remodule_t* mod, const remodule_var_info_t* var) {
+	if (remodule_thread_id == 0) {
+		remodule_thread_id = remodule_atomic_fetch_add(&remodule_next_thread_id, 1) + 1;
+		remodule_on_thread_exit(remodule_thread_id);
+	}
+	int thread_id = remodule_thread_id;
+	uint32_t hash = remodule_hash(var->name, var->name_length) ^ ((uint32_t)thread_id * 2654435761u);
+
+	remodule_mutex_lock(&mod->tls_mutex);
+
+	remodule_tls_storage_t* storage = NULL;
+	if (mod->tls_index_capacity > 0) {
+		size_t mask = mod->tls_index_capacity - 1;
+		for (
+			size_t slot = hash & mask;
+			mod->tls_index[slot] != 0;
+			slot = (slot + 1) & mask
+		) {
+			remodule_tls_storage_t* entry = &mod->tls_storage[mod->tls_index[slot] - 1];
+			if (
+				entry->hash == hash
+				&& entry->thread_id == thread_id
+				&& entry->name_length == var->name_length
+				&& memcmp(entry->name, var->name, var->name_length) == 0
+			) {
+				storage = entry;
+				break;
+			}
+		}
+	}
+
+	if (storage == NULL) {
+		if (mod->num_tls_storage == mod->tls_storage_capacity) {
+			mod->tls_storage_capacity = mod->tls_storage_capacity > 0 ? mod->tls_storage_capacity * 2 : 8;
+			mod->tls_storage = realloc(
+				mod->tls_storage,
+				mod->tls_storage_capacity * sizeof(remodule_tls_storage_t)
+			);
+		}
+
+		char* name = malloc(var->name_length);
+		memcpy(name, var->name, var->name_length);
+		size_t entry_index = mod->num_tls_storage++;
+		storage = &mod->tls_storage[entry_index];
+		*storage = (remodule_tls_storage_t){
+			.name = name,
+			.name_length = var->name_length,
+			.thread_id = thread_id,
+			.hash = hash,
+		};
+
+		size_t index_capacity = remodule_index_capacity(mod->num_tls_storage);
+		if (index_capacity > mod->tls_index_capacity) {
+			free(mod->tls_index);
+			mod->tls_index = malloc(index_capacity * sizeof(uint32_t));
+			mod->tls_index_capacity = index_capacity;
+			remodule_tls_rebuild_index(mod);
+		} else {
+			remodule_tls_index_insert(mod, entry_index);
+		}
+	}
+
+	if (
+		storage->value == NULL
+		|| storage->value_size != var->value_size
+		|| storage->value_align != var->value_align
+	) {
+		// New or incompatible
+		mod->stats.memory.thread_local_reserved -= storage->value_size;
+		remodule_aligned_free(storage->value);
+		storage->value = remodule_aligned_alloc(var->value_size, var->value_align);
+		REMODULE_ASSERT(storage->value != NULL, "Could not allocate thread-local var");
+		storage->value_size = var->value_size;
+		storage->value_align = var->value_align;
+		mod->stats.memory.thread_local_reserved += var->value_size;
+	}
+	void* value = storage->value;
+
+	remodule_mutex_unlock(&mod->tls_mutex);
+	return value;
+}
+
+static const remodule_host_api_t remodule_host_api = {
+	.arena_alloc = remodule_arena_alloc,
+	.pool_alloc = remodule_pool_alloc,
+	.pool_free = remodule_pool_free,
+	.frame_alloc = remodule_frame_alloc,
+	.frame_reset = remodule_frame_reset,
+	.publish = remodule_publish,
+	.tls_bind = remodule_tls_bind,
+};
+
+static void
+remodule_attach(remodule_t* mod, remodule_plugin_info_t* info) {
+	// Written into the plugin's own copy so that remodule_self works
+	info->mod = mod;
+	info->host_api = &remodule_host_api;
+}
+
+remodule_t*
+remodule_load_ex(const char* path, void* userdata, const remodule_load_options_t* options) {
+	static const remodule_load_options_t default_options = { 0 };
+	if (options == NULL) { options = &default_options; }
+
+	uint64_t start_ns = remodule_now_ns();
+
+	// Before opening, a build landing in between only costs an extra reload
+	uint64_t image_id = 0;
+	bool has_image_id = remodule_image_id(path, &image_id);
+	remodule_dynlib_remove_stale_copies(path);
+
+	remodule_dynlib_t lib = options->instanced
+		? remodule_dynlib_open_private(path, options->in_memory)
+		: remodule_dynlib_open(path);
+	REMODULE_ASSERT(lib != NULL, "Could not load library");
+
+	remodule_plugin_info_t* info = remodule_dynlib_find(lib, REMODULE_INFO_SYMBOL_STR);
+	REMODULE_ASSERT(info != NULL, "Module does not export info struct");
+
+	remodule_t* mod = malloc(sizeof(remodule_t));
+	remodule_attach(mod, info);
+	*mod = (remodule_t){
+		.userdata = userdata,
+		.path = options->instanced
+			? remodule_dynlib_get_private_path(lib)
+			: remodule_dynlib_get_path(lib),
+		.info = *info,
+		.lib = lib,
+		.image_id = image_id,
+		.has_image_id = has_image_id,
+		.reload_unchanged = options->reload_unchanged,
+		.in_memory = options->in_memory,
+	};
+	// Reloads open the module again from this path
+	REMODULE_ASSERT(mod->path != NULL, "Could not get module path");
+	remodule_atomic_ptr_store(&mod->published, NULL);
+	remodule_atomic_ptr_store(&mod->readers, NULL);
+	remodule_atomic_store(&mod->epoch, 1);
+	remodule_atomic_ptr_store(&mod->call_counters, NULL);
+	remodule_mutex_init(&mod->tls_mutex);
+	remodule_tls_link(mod);
+	remodule_scan_vars(&mod->vars, &mod->info);
+	REMODULE_ASSERT(remodule_check_export_ids(&mod->vars), "Module exports two symbols at one index");
+	remodule_bind_host_vars(mod, &mod->vars);
+	remodule_bind_exports(mod, &mod->vars);
+
+	if (options->snapshot_path != NULL) {
+		size_t snapshot_path_len = strlen(options->snapshot_path);
+		mod->snapshot_path = malloc(snapshot_path_len + 1);
+		memcpy(mod->snapshot_path, options->snapshot_path, snapshot_path_len + 1);
+
+		remodule_load_snapshot(mod);
+	}
+
+	mod->info.entry(REMODULE_OP_LOAD, userdata);
+
+	mod->stats.load_ns = remodule_now_ns() - start_ns;
+	remodule_notify_stats(mod, REMODULE_OP_LOAD);
+	return mod;
+}
+
+static bool
+remodule_is_unchanged(remodule_t* mod, uint64_t* image_id, bool* has_image_id) {
+	*has_image_id = remodule_image_id(mod->path, image_id);
+	return !mod->reload_unchanged
+		&& *has_image_id
+		&& mod->has_image_id
+		&& *image_id == mod->image_id;
+}
+
+static remodule_reload_status_t
+remodule_stage(remodule_t* mod);
+
+static void
+remodule_commit_staged(remodule_t* mod, uint64_t start_ns);
+
+bool
+remodule_reload(remodule_t* mod) {
+	REMODULE_ASSERT(
+		remodule_atomic_load(&mod->reload_status) == REMODULE_RELOAD_IDLE,
+		"A background reload is in progress"
+	);
 
-#if defined(_MSC_VER)
-#	define REMODULE_VAR_INFO_BEGIN (&remodule_var_info_begin + 1)
-#	define REMODULE_VAR_INFO_END (&remodule_var_info_end)
-#elif defined(__unix__) || defined(__APPLE__)
-#	define REMODULE_VAR_INFO_BEGIN (&__start_remodule)
-#	define REMODULE_VAR_INFO_END (&__stop_remodule)
-#endif
+	// Readers run the old instance until the new one is published.
+	// Staging copies their state right before that instead of before loading.
+	if (remodule_has_readers(mod)) {
+		uint64_t start_ns = remodule_now_ns();
+		remodule_reload_status_t status = remodule_stage(mod);
+		if (status == REMODULE_RELOAD_UNCHANGED) {
+			++mod->stats.unchanged_count;
+			return false;
+		}
+		REMODULE_ASSERT(status == REMODULE_RELOAD_READY, "Failed to reload");
 
-void
-remodule_entry(remodule_op_t op, void* userdata);
+		remodule_commit_staged(mod, start_ns);
+		return true;
+	}
 
-REMODULE_EXPORT remodule_plugin_info_t REMODULE_INFO_SYMBOL = {
-	.entry = &remodule_entry,
-	.var_info_begin = REMODULE_VAR_INFO_BEGIN,
-	.var_info_end = REMODULE_VAR_INFO_END,
-};
+	uint64_t image_id;
+	bool has_image_id;
+	if (remodule_is_unchanged(mod, &image_id, &has_image_id)) {
+		++mod->stats.unchanged_count;
+		return false;
+	}
+	mod->image_id = image_id;
+	mod->has_image_id = has_image_id;
 
-#endif
+	uint64_t start_ns = remodule_now_ns();
+	mod->info.entry(REMODULE_OP_BEFORE_RELOAD, mod->userdata);
+	uint64_t phase_start_ns = remodule_record_phase(mod, REMODULE_PHASE_BEFORE_RELOAD, start_ns);
 
-#if defined(REMODULE_HOST_IMPLEMENTATION) && !defined(REMODULE_HOST_IMPLEMENTATION_GUARD)
-#define REMODULE_HOST_IMPLEMENTATION_GUARD
+	// Store all static vars in a host-allocated buffer
+	size_t num_vars = mod->vars.num_vars;
+	size_t num_fields = mod->vars.num_fields;
+	size_t index_capacity = remodule_index_capacity(num_vars);
+	char* tmp_buf = remodule_scratch(
+		mod,
+		mod->vars.values_size
+		+ num_vars * sizeof(remodule_tmp_var_storage_t)
+		+ num_fields * sizeof(remodule_field_info_t)
+		+ index_capacity * sizeof(uint32_t)
+		+ mod->vars.names_size
+	);
+	// Values go first so that migration callbacks get aligned pointers
+	char* value_ptr = tmp_buf;
+	remodule_tmp_var_storage_t* tmp_storage = (remodule_tmp_var_storage_t*)(tmp_buf + mod->vars.values_size);
+	remodule_field_info_t* field_ptr = (remodule_field_info_t*)(tmp_storage + num_vars);
+	uint32_t* index_slots = (uint32_t*)(field_ptr + num_fields);
+	char* data_ptr = (char*)(index_slots + index_capacity);
+	size_t snapshot_bytes = 0;
 
-#include <stdlib.h>
-#include <string.h>
+	for (size_t i = 0; i < num_vars; ++i) {
+		const remodule_var_t* var = &mod->vars.vars[i];
+		remodule_tmp_var_storage_t* entry = &tmp_storage[i];
 
-#if defined(_WIN32)
+		entry->name = data_ptr;
+		entry->name_length = var->info->name_length;
+		entry->hash = var->hash;
+		data_ptr += var->info->name_length;
 
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-#include <windows.h>
+		entry->value = value_ptr;
+		entry->value_size = var->info->value_size;
+		value_ptr += (var->info->value_size + REMODULE_MAX_ALIGN - 1) & ~(REMODULE_MAX_ALIGN - 1);
+		snapshot_bytes += var->info->value_size;
 
-#define REMODULE_PATH_MAX MAX_PATH
+		memcpy(entry->name, var->info->name, var->info->name_length);
+		memcpy(entry->value, var->info->value_addr, var->info->value_size);
 
-typedef struct remodule_dynlib_info_s {
-	HMODULE handle;
-	char watch_path[];
-} remodule_dynlib_info_t;
+		// The layout lives in the old instance, copy it too
+		entry->fields = var->info->fields != NULL ? field_ptr : NULL;
+		entry->num_fields = var->info->num_fields;
+		for (size_t j = 0; j < var->info->num_fields; ++j) {
+			const remodule_field_info_t* field = &var->info->fields[j];
+			remodule_field_info_t* field_copy = field_ptr++;
+			*field_copy = *field;
 
-typedef remodule_dynlib_info_t* remodule_dynlib_t;
+			field_copy->name = data_ptr;
+			memcpy(data_ptr, field->name, field->name_length);
+			data_ptr += field->name_length;
 
-static remodule_dynlib_t
-remodule_dynlib_open(const char* path) {
-	// Load once to find the real absolute path
-	HMODULE module = LoadLibraryExA(
-		path,
-		NULL,
-		DONT_RESOLVE_DLL_REFERENCES
-	);
-	if (module == NULL) { return NULL; }
+			field_copy->type_name = data_ptr;
+			memcpy(data_ptr, field->type_name, field->type_name_length);
+			data_ptr += field->type_name_length;
+		}
+	}
+	mod->stats.snapshot_bytes = snapshot_bytes;
+	remodule_collect_anchors(mod, &mod->vars, true);
+	phase_start_ns = remodule_record_phase(mod, REMODULE_PHASE_SNAPSHOT, phase_start_ns);
 
-	char watch_path[MAX_PATH];
-	DWORD watch_path_len = GetModuleFileNameA(module, watch_path, sizeof(watch_path));
-	REMODULE_ASSERT(watch_path_len > 0, "Could not get module name");
-	FreeLibrary(module);
+	// With readers, the old instance can only go after the new one is published
+	remodule_dynlib_t old_lib = mod->lib;
+	bool retire_old_lib = remodule_has_readers(mod);
+	if (!retire_old_lib) {
+		// Entry points and exports never target an unmapped image
+		remodule_clear_functions(mod);
+		remodule_clear_exports(mod);
+		remodule_dynlib_close(old_lib);
+	}
+	phase_start_ns = remodule_record_phase(mod, REMODULE_PHASE_CLOSE, phase_start_ns);
 
-	// Create a temporary file name
-	char dir_buf[MAX_PATH];
-	char name_buf[MAX_PATH];
-	char tmp_name_buf[MAX_PATH];
-	char* file_part;
+	mod->lib = remodule_dynlib_open_private(mod->path, mod->in_memory);
+	REMODULE_ASSERT(mod->lib != NULL, "Failed to reload");
 
-	GetFullPathNameA(watch_path, sizeof(dir_buf), dir_buf, &file_part);
-	size_t name_len = strlen(file_part);
-	memcpy(name_buf, file_part, name_len);
-	*file_part = '\0';
-	GetTempFileNameA(dir_buf, name_buf, 0, tmp_name_buf);
+	remodule_plugin_info_t* info = remodule_dynlib_find(mod->lib, REMODULE_INFO_SYMBOL_STR);
+	REMODULE_ASSERT(info != NULL, "Module does not export info struct");
+	remodule_attach(mod, info);
+	mod->info = *info;
+	remodule_scan_vars(&mod->vars, &mod->info);
+	REMODULE_ASSERT(remodule_check_export_ids(&mod->vars), "Module exports two symbols at one index");
+	phase_start_ns = remodule_record_phase(mod, REMODULE_PHASE_OPEN, phase_start_ns);
 
-	// Copy the file over
-	REMODULE_ASSERT(CopyFileA(watch_path, tmp_name_buf, FALSE), "Could not create temporary file");
+	// Copy vars back in
+	remodule_restore_vars(&mod->stats, &mod->vars, index_slots, index_capacity, tmp_storage, num_vars);
+	remodule_bind_host_vars(mod, &mod->vars);
+	remodule_relocate_pointers(mod, &mod->vars);
+	phase_start_ns = remodule_record_phase(mod, REMODULE_PHASE_RESTORE, phase_start_ns);
 
-	// Load the temporary file
-	module = LoadLibraryA(tmp_name_buf);
-	if (module == NULL) { return NULL; }
+	mod->info.entry(REMODULE_OP_AFTER_RELOAD, mod->userdata);
+	remodule_record_phase(mod, REMODULE_PHASE_AFTER_RELOAD, phase_start_ns);
 
-	remodule_dynlib_t lib = malloc(sizeof(remodule_dynlib_info_t) + watch_path_len + 1);
-	lib->handle = module;
-	memcpy(lib->watch_path, watch_path, watch_path_len);
-	lib->watch_path[watch_path_len] = '\0';
-	return lib;
-}
+	// Callers only reach the new instance once it has initialized
+	remodule_retarget_functions(mod, &mod->vars);
+	remodule_bind_exports(mod, &mod->vars);
 
-static void*
-remodule_dynlib_find(remodule_dynlib_t lib, const char* name) {
-	return (void*)GetProcAddress(lib->handle, name);
+	remodule_release_old_lib(mod, old_lib, retire_old_lib);
+	remodule_finish_reload(mod, start_ns);
+	return true;
 }
 
-static void
-remodule_dynlib_close(remodule_dynlib_t lib) {
-	char name_buf[MAX_PATH];
-	REMODULE_ASSERT(GetModuleFileNameA(lib->handle, name_buf, sizeof(name_buf)) > 0, "Could not get module name");
+static remodule_reload_status_t
+remodule_stage(remodule_t* mod) {
+	uint64_t start_ns = remodule_now_ns();
 
-	FreeLibrary(lib->handle);
-	DeleteFileA(name_buf);
-	free(lib);
-}
+	if (remodule_is_unchanged(mod, &mod->staged_image_id, &mod->staged_has_image_id)) {
+		return REMODULE_RELOAD_UNCHANGED;
+	}
 
-static char*
-remodule_dynlib_get_path(remodule_dynlib_t lib) {
-	return _strdup(lib->watch_path);
+	// Load the new instance while the old one is still serving
+	remodule_dynlib_t lib = remodule_dynlib_open_private(mod->path, mod->in_memory);
+	if (lib == NULL) {
+		// The loader names the private copy, not the module
+		snprintf(
+			mod->reload_error, sizeof(mod->reload_error),
+			"Could not load %s (%s)", mod->path, remodule_last_error()
+		);
+		return REMODULE_RELOAD_FAILED;
+	}
+
+	remodule_plugin_info_t* info = remodule_dynlib_find(lib, REMODULE_INFO_SYMBOL_STR);
+	if (info == NULL) {
+		remodule_dynlib_close(lib);
+		snprintf(
+			mod->reload_error, sizeof(mod->reload_error),
+			"%s does not export info struct", mod->path
+		);
+		return REMODULE_RELOAD_FAILED;
+	}
+
+	remodule_scan_vars(&mod->staged_vars, info);
+	if (!remodule_check_export_ids(&mod->staged_vars)) {
+		remodule_dynlib_close(lib);
+		snprintf(
+			mod->reload_error, sizeof(mod->reload_error),
+			"%s exports two symbols at one index", mod->path
+		);
+		return REMODULE_RELOAD_FAILED;
+	}
+
+	mod->staged_lib = lib;
+	remodule_attach(mod, info);
+	mod->staged_info = *info;
+
+	// Recorded on commit, stats are only touched by the owning thread
+	mod->stage_ns = remodule_now_ns() - start_ns;
+	return REMODULE_RELOAD_READY;
 }
 
 static void
-remodule_dynlib_free_path(char* path) {
-	free(path);
+remodule_record_unchanged(remodule_t* mod) {
+	++mod->stats.unchanged_count;
+	snprintf(mod->reload_error, sizeof(mod->reload_error), "Module is unchanged");
 }
 
-static char remodule_error_msg_buf[2048];
+static void
+remodule_commit_staged(remodule_t* mod, uint64_t start_ns) {
+	remodule_record_timing(&mod->stats.phases[REMODULE_PHASE_OPEN], mod->stage_ns);
 
-const char*
-remodule_last_error(void) {
-	FormatMessageA(
-		FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-		NULL,
-		GetLastError(),
-		MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-		remodule_error_msg_buf,
-		sizeof(remodule_error_msg_buf),
-		NULL
-	);
-	return remodule_error_msg_buf;
-}
+	uint64_t phase_start_ns = remodule_now_ns();
+	mod->info.entry(REMODULE_OP_BEFORE_RELOAD, mod->userdata);
+	phase_start_ns = remodule_record_phase(mod, REMODULE_PHASE_BEFORE_RELOAD, phase_start_ns);
 
-#elif defined(__unix__) || defined(__APPLE__)
+	// Both instances are alive so entries can point straight at the old vars
+	size_t num_vars = mod->vars.num_vars;
+	size_t index_capacity = remodule_index_capacity(num_vars);
+	char* tmp_buf = remodule_scratch(
+		mod,
+		num_vars * sizeof(remodule_tmp_var_storage_t)
+		+ index_capacity * sizeof(uint32_t)
+	);
+	remodule_tmp_var_storage_t* entries = (remodule_tmp_var_storage_t*)tmp_buf;
+	uint32_t* index_slots = (uint32_t*)(entries + num_vars);
 
-#include <dlfcn.h>
-#include <errno.h>
-#include <link.h>
+	for (size_t i = 0; i < num_vars; ++i) {
+		const remodule_var_t* var = &mod->vars.vars[i];
+		entries[i] = (remodule_tmp_var_storage_t){
+			.name = (char*)var->info->name,
+			.name_length = var->info->name_length,
+			.value = var->info->value_addr,
+			.value_size = var->info->value_size,
+			.fields = var->info->fields,
+			.num_fields = var->info->num_fields,
+			.hash = var->hash,
+		};
+	}
+	mod->stats.snapshot_bytes = 0;
+	phase_start_ns = remodule_record_phase(mod, REMODULE_PHASE_SNAPSHOT, phase_start_ns);
 
-#define REMODULE_PATH_MAX PATH_MAX
+	remodule_restore_vars(&mod->stats, &mod->staged_vars, index_slots, index_capacity, entries, num_vars);
+	remodule_bind_host_vars(mod, &mod->staged_vars);
+	remodule_collect_anchors(mod, &mod->vars, false);
+	remodule_relocate_pointers(mod, &mod->staged_vars);
+	phase_start_ns = remodule_record_phase(mod, REMODULE_PHASE_RESTORE, phase_start_ns);
 
-typedef void* remodule_dynlib_t;
+	// Retire the old instance
+	remodule_dynlib_t old_lib = mod->lib;
+	bool retire_old_lib = remodule_has_readers(mod);
+	if (!retire_old_lib) { remodule_dynlib_close(old_lib); }
+	phase_start_ns = remodule_record_phase(mod, REMODULE_PHASE_CLOSE, phase_start_ns);
+	mod->lib = mod->staged_lib;
+	mod->info = mod->staged_info;
+	mod->staged_lib = NULL;
+	mod->image_id = mod->staged_image_id;
+	mod->has_image_id = mod->staged_has_image_id;
+	remodule_var_table_t vars = mod->vars;
+	mod->vars = mod->staged_vars;
+	mod->staged_vars = vars;
 
-static remodule_dynlib_t
-remodule_dynlib_open(const char* path) {
-	return dlopen(path, RTLD_NOW | RTLD_LOCAL);
-}
+	mod->info.entry(REMODULE_OP_AFTER_RELOAD, mod->userdata);
+	remodule_record_phase(mod, REMODULE_PHASE_AFTER_RELOAD, phase_start_ns);
 
-static void*
-remodule_dynlib_find(remodule_dynlib_t lib, const char* name) {
-	return dlsym(lib, name);
-}
+	// Callers only reach the new instance once it has initialized
+	remodule_retarget_functions(mod, &mod->vars);
+	remodule_bind_exports(mod, &mod->vars);
 
-static void
-remodule_dynlib_close(remodule_dynlib_t lib) {
-	dlclose(lib);
+	remodule_release_old_lib(mod, old_lib, retire_old_lib);
+	remodule_finish_reload(mod, start_ns);
 }
 
-static char*
-remodule_dynlib_get_path(remodule_dynlib_t lib) {
-	struct link_map* link_map;
-	REMODULE_ASSERT(
-		dlinfo(lib, RTLD_DI_LINKMAP, &link_map) == 0,
-		"Could not read library info"
-	);
+bool
+remodule_reload_staged(remodule_t* mod) {
+	if (remodule_atomic_load(&mod->reload_status) != REMODULE_RELOAD_IDLE) {
+		return false;
+	}
 
-	size_t size = strlen(link_map->l_name) + 1;
-	char* path = malloc(size);
-	memcpy(path, link_map->l_name, size);
+	uint64_t start_ns = remodule_now_ns();
+	mod->reload_error[0] = '\0';
+	remodule_reload_status_t status = remodule_stage(mod);
+	if (status == REMODULE_RELOAD_UNCHANGED) { remodule_record_unchanged(mod); }
+	if (status != REMODULE_RELOAD_READY) { return false; }
 
-	return path;
+	remodule_commit_staged(mod, start_ns);
+	return true;
 }
 
 static void
-remodule_dynlib_free_path(char* path) {
-	free(path);
+remodule_stage_worker(void* arg) {
+	remodule_t* mod = arg;
+
+	remodule_reload_status_t status = remodule_stage(mod);
+	remodule_atomic_store(&mod->reload_status, status);
 }
 
-const char*
-remodule_last_error(void) {
-	const char* dlerror_str = dlerror();
-	return dlerror_str != NULL ? dlerror_str : strerror(errno);
+bool
+remodule_reload_begin(remodule_t* mod) {
+	if (remodule_atomic_load(&mod->reload_status) != REMODULE_RELOAD_IDLE) {
+		return false;
+	}
+
+	mod->reload_error[0] = '\0';
+	remodule_atomic_store(&mod->reload_status, REMODULE_RELOAD_PENDING);
+	if (!remodule_thread_start(&mod->stage_thread, remodule_stage_worker, mod)) {
+		remodule_atomic_store(&mod->reload_status, REMODULE_RELOAD_IDLE);
+		return false;
+	}
+
+	return true;
 }
 
-#endif
+typedef struct remodule_batch_s {
+	remodule_t** mods;
+	size_t num_mods;
+	remodule_atomic_int_t next_mod;
+} remodule_batch_t;
 
-typedef struct remodule_tmp_var_storage_s {
-	char* name;
-	void* value;
-	size_t name_length;
-	size_t value_size;
-} remodule_tmp_var_storage_t;
+static void
+remodule_batch_worker(void* arg) {
+	remodule_batch_t* batch = arg;
 
-struct remodule_s {
-	void* userdata;
-	remodule_plugin_info_t info;
-	remodule_dynlib_t lib;
-	char* path;
-};
+	while (true) {
+		size_t index = (size_t)remodule_atomic_fetch_add(&batch->next_mod, 1);
+		if (index >= batch->num_mods) { break; }
 
-remodule_t*
-remodule_load(const char* path, void* userdata) {
-	remodule_dynlib_t lib = remodule_dynlib_open(path);
-	REMODULE_ASSERT(lib != NULL, "Could not load library");
+		remodule_stage_worker(batch->mods[index]);
+	}
+}
 
-	remodule_plugin_info_t* info = remodule_dynlib_find(lib, REMODULE_INFO_SYMBOL_STR);
-	REMODULE_ASSERT(info != NULL, "Module does not export info struct");
+size_t
+remodule_reload_many(remodule_t** mods, size_t num_mods, int num_threads) {
+	// Claim every idle module
+	remodule_t** claimed_mods = malloc(num_mods * sizeof(remodule_t*));
+	size_t num_claimed = 0;
+	for (size_t i = 0; i < num_mods; ++i) {
+		remodule_t* mod = mods[i];
+		if (remodule_atomic_load(&mod->reload_status) != REMODULE_RELOAD_IDLE) {
+			continue;
+		}
 
-	info->entry(REMODULE_OP_LOAD, userdata);
+		mod->reload_error[0] = '\0';
+		remodule_atomic_store(&mod->reload_status, REMODULE_RELOAD_PENDING);
+		claimed_mods[num_claimed++] = mod;
+	}
 
-	remodule_t* mod = malloc(sizeof(remodule_t));
-	*mod = (remodule_t){
-		.userdata = userdata,
-		.path = remodule_dynlib_get_path(lib),
-		.info = *info,
-		.lib = lib,
+	remodule_batch_t batch = {
+		.mods = claimed_mods,
+		.num_mods = num_claimed,
 	};
-	return mod;
-}
+	remodule_atomic_store(&batch.next_mod, 0);
 
-void
-remodule_reload(remodule_t* mod) {
-	mod->info.entry(REMODULE_OP_BEFORE_RELOAD, mod->userdata);
+	// Load in parallel, the calling thread is one of the workers
+	if (num_threads <= 0) { num_threads = remodule_num_cpus(); }
+	if ((size_t)num_threads > num_claimed) { num_threads = (int)num_claimed; }
+	int num_extra_threads = num_threads > 1 ? num_threads - 1 : 0;
+	remodule_thread_t* threads = NULL;
+	int num_started_threads = 0;
+	if (num_extra_threads > 0) {
+		threads = malloc(num_extra_threads * sizeof(remodule_thread_t));
+		for (int i = 0; i < num_extra_threads; ++i) {
+			if (!remodule_thread_start(&threads[i], remodule_batch_worker, &batch)) { break; }
+			++num_started_threads;
+		}
+	}
 
-	// Store all static vars in a host-allocated buffer
-	int num_vars = 0;
-	size_t val_buffer_size = 0;
-	size_t name_buffer_size = 0;
-	for (
-		const remodule_var_info_t* const* itr = mod->info.var_info_begin;
-		itr != mod->info.var_info_end;
-		++itr
-	) {
-		if (*itr == NULL) { continue; }
-		remodule_var_info_t var_info = **itr;
+	remodule_batch_worker(&batch);
+	for (int i = 0; i < num_started_threads; ++i) {
+		remodule_thread_join(threads[i]);
+	}
+	free(threads);
 
-		++num_vars;
-		val_buffer_size += var_info.value_size;
-		name_buffer_size += var_info.name_length;
+	// Swap all instances in one go
+	size_t num_reloaded = 0;
+	for (size_t i = 0; i < num_claimed; ++i) {
+		remodule_t* mod = claimed_mods[i];
+		remodule_reload_status_t status = remodule_atomic_load(&mod->reload_status);
+		remodule_atomic_store(&mod->reload_status, REMODULE_RELOAD_IDLE);
+		if (status == REMODULE_RELOAD_UNCHANGED) { remodule_record_unchanged(mod); }
+		if (status == REMODULE_RELOAD_READY) {
+			remodule_commit_staged(mod, remodule_now_ns());
+			++num_reloaded;
+		}
 	}
+	free(claimed_mods);
 
-	void* tmp_buf = malloc(
-		num_vars * sizeof(remodule_tmp_var_storage_t)
-		+ val_buffer_size
-		+ name_buffer_size
-	);
-	remodule_tmp_var_storage_t* entry_ptr = tmp_buf;
-	char* data_ptr = (char*)(entry_ptr + num_vars);
+	return num_reloaded;
+}
 
-	for (
-		const remodule_var_info_t* const* itr = mod->info.var_info_begin;
-		itr != mod->info.var_info_end;
-		++itr
-	) {
-		if (*itr == NULL) { continue; }
-		remodule_var_info_t var_info = **itr;
+remodule_reload_status_t
+remodule_reload_poll(remodule_t* mod) {
+	return (remodule_reload_status_t)remodule_atomic_load(&mod->reload_status);
+}
+
+bool
+remodule_reload_commit(remodule_t* mod) {
+	if (remodule_atomic_load(&mod->reload_status) == REMODULE_RELOAD_IDLE) {
+		snprintf(mod->reload_error, sizeof(mod->reload_error), "No reload in progress");
+		return false;
+	}
 
-		remodule_tmp_var_storage_t* entry = entry_ptr++;
+	remodule_thread_join(mod->stage_thread);
+	remodule_reload_status_t status = remodule_atomic_load(&mod->reload_status);
+	remodule_atomic_store(&mod->reload_status, REMODULE_RELOAD_IDLE);
+	if (status == REMODULE_RELOAD_UNCHANGED) { remodule_record_unchanged(mod); }
+	if (status != REMODULE_RELOAD_READY) { return false; }
 
-		entry->name = data_ptr;
-		entry->name_length = var_info.name_length;
-		data_ptr += var_info.name_length;
+	remodule_commit_staged(mod, remodule_now_ns());
+	return true;
+}
 
-		entry->value = data_ptr;
-		entry->value_size = var_info.value_size;
-		data_ptr += var_info.value_size;
+const char*
+remodule_reload_error(remodule_t* mod) {
+	return mod->reload_error;
+}
 
-		memcpy(entry->name, var_info.name, var_info.name_length);
-		memcpy(entry->value, var_info.value_addr, var_info.value_size);
+void
+remodule_unload(remodule_t* mod) {
+	// Discard any background reload
+	if (remodule_atomic_load(&mod->reload_status) != REMODULE_RELOAD_IDLE) {
+		remodule_thread_join(mod->stage_thread);
+		if (remodule_atomic_load(&mod->reload_status) == REMODULE_RELOAD_READY) {
+			remodule_dynlib_close(mod->staged_lib);
+		}
 	}
 
+	uint64_t start_ns = remodule_now_ns();
+	// Before the plugin gets to tear down its state
+	remodule_save_snapshot(mod);
+	// Readers must be out before anything is torn down
+	remodule_atomic_ptr_store(&mod->published, NULL);
+	if (remodule_has_readers(mod)) { remodule_synchronize(mod); }
+	mod->info.entry(REMODULE_OP_UNLOAD, mod->userdata);
 	remodule_dynlib_close(mod->lib);
-	mod->lib = remodule_dynlib_open(mod->path);
-	REMODULE_ASSERT(mod->lib != NULL, "Failed to reload");
+	mod->stats.unload_ns = remodule_now_ns() - start_ns;
+	remodule_notify_stats(mod, REMODULE_OP_UNLOAD);
 
-	remodule_plugin_info_t* info = remodule_dynlib_find(mod->lib, REMODULE_INFO_SYMBOL_STR);
-	REMODULE_ASSERT(info != NULL, "Module does not export info struct");
-	mod->info = *info;
-
-	// Copy vars back in
-	remodule_tmp_var_storage_t* tmp_storage = (remodule_tmp_var_storage_t*)tmp_buf;
+	remodule_dynlib_free_path(mod->path);
+	free(mod->snapshot_path);
+	free(mod->scratch_buf);
+	remodule_free_host_storage(mod->host_storage, mod->num_host_storage);
+	free(mod->host_storage);
+	free(mod->dropped_host_storage);
+	remodule_tls_unlink(mod);
+	for (size_t i = 0; i < mod->num_tls_storage; ++i) {
+		free(mod->tls_storage[i].name);
+		remodule_aligned_free(mod->tls_storage[i].value);
+	}
+	free(mod->tls_storage);
+	free(mod->tls_index);
+	for (size_t i = 0; i < mod->num_functions; ++i) {
+		free(mod->functions[i]->name);
+		free(mod->functions[i]);
+	}
+	free(mod->functions);
+	free(mod->exports);
+	for (size_t i = 0; i < mod->num_old_exports; ++i) {
+		free(mod->old_exports[i].entries);
+	}
+	free(mod->old_exports);
+	remodule_mutex_destroy(&mod->tls_mutex);
+	remodule_free_allocators(mod);
+	free(mod->retired);
+	for (remodule_reader_t* reader = remodule_atomic_ptr_load(&mod->readers); reader != NULL;) {
+		remodule_reader_t* next = reader->next;
+		remodule_aligned_free(reader);
+		reader = next;
+	}
 	for (
-		const remodule_var_info_t* const* var_itr = mod->info.var_info_begin;
-		var_itr != mod->info.var_info_end;
-		++var_itr
+		remodule_call_counter_slot_t* slot = remodule_atomic_ptr_load(&mod->call_counters);
+		slot != NULL;
 	) {
-		if (*var_itr == NULL) { continue; }
-		remodule_var_info_t var_info = **var_itr;
+		remodule_call_counter_slot_t* next = slot->next;
+		remodule_aligned_free(slot);
+		slot = next;
+	}
+	free(mod->old_anchors);
+	free(mod->old_anchor_names);
+	free(mod->vars.vars);
+	free(mod->vars.host_vars);
+	free(mod->vars.relocatables);
+	free(mod->staged_vars.vars);
+	free(mod->staged_vars.host_vars);
+	free(mod->staged_vars.relocatables);
+	free(mod);
+}
 
-		for (
-			int storage_index = 0; storage_index < num_vars; ++storage_index
+const remodule_export_t*
+remodule_exports(remodule_t* mod, size_t* num_exports) {
+	if (num_exports != NULL) { *num_exports = mod->num_exports; }
+	return mod->exports;
+}
+
+remodule_fn_t volatile const*
+remodule_function(remodule_t* mod, const char* name) {
+	size_t name_length = strlen(name);
+	uint32_t hash = remodule_hash(name, name_length);
+	for (size_t i = 0; i < mod->num_functions; ++i) {
+		remodule_function_t* function = mod->functions[i];
+		if (
+			function->hash == hash
+			&& function->name_length == name_length
+			&& memcmp(function->name, name, name_length) == 0
 		) {
-			remodule_tmp_var_storage_t* storage = &tmp_storage[storage_index];
-			if (
-				storage->name_length == var_info.name_length
-				&& storage->value_size == var_info.value_size
-				&& memcmp(storage->name, var_info.name, storage->name_length) == 0
-			) {
-				memcpy(var_info.value_addr, storage->value, storage->value_size);
-				break;
-			}
+			return &function->fn;
 		}
 	}
-	free(tmp_buf);
 
-	mod->info.entry(REMODULE_OP_AFTER_RELOAD, mod->userdata);
+	if (mod->num_functions == mod->functions_capacity) {
+		mod->functions_capacity = mod->functions_capacity > 0 ? mod->functions_capacity * 2 : 8;
+		mod->functions = realloc(mod->functions, mod->functions_capacity * sizeof(remodule_function_t*));
+	}
+
+	// Allocated one by one so that entry points never move
+	remodule_function_t* function = malloc(sizeof(remodule_function_t));
+	char* name_copy = malloc(name_length);
+	memcpy(name_copy, name, name_length);
+	*function = (remodule_function_t){
+		.name = name_copy,
+		.name_length = name_length,
+		.hash = hash,
+	};
+	function->fn = remodule_find_function(&mod->vars, function);
+	mod->functions[mod->num_functions++] = function;
+
+	return &function->fn;
+}
+
+const remodule_stats_t*
+remodule_stats(remodule_t* mod) {
+	return &mod->stats;
 }
 
 void
-remodule_unload(remodule_t* mod) {
-	mod->info.entry(REMODULE_OP_UNLOAD, mod->userdata);
-	remodule_dynlib_free_path(mod->path);
-	remodule_dynlib_close(mod->lib);
-	free(mod);
+remodule_set_stats_hook(remodule_stats_hook_t hook, void* userdata) {
+	remodule_stats_hook_fn = hook;
+	remodule_stats_hook_userdata = userdata;
 }
 
 const char*
@@ -18,6 +18,49 @@
 //! A monitor handle.
 typedef struct remodule_monitor_s remodule_monitor_t;
 
+/**
+ * @brief Options for @link remodule_monitor_ex @endlink.
+ *
+ * A zero-initialized struct gives the same behaviour as @link remodule_monitor @endlink.
+ */
+typedef struct remodule_monitor_options_s {
+	/**
+	 * @brief How long the file must stay untouched before a change is reported, in milliseconds.
+	 *
+	 * Linkers and build systems often write or rename a file several times in a row.
+	 * All changes within the window are coalesced into a single reload.
+	 *
+	 * 0 reports a change on the next check after it is seen.
+	 */
+	int settle_ms;
+
+	/**
+	 * @brief Check the file with `stat` instead of file system notifications.
+	 *
+	 * Notifications are not delivered for changes made by another host, such as over NFS.
+	 * Polling is always used for files on network and FUSE file systems, or when a directory cannot be watched.
+	 * This option forces it for other setups, such as bind mounts in containers.
+	 *
+	 * Polled files are checked together, every `REMODULE_MONITOR_POLL_MIN_MS` after a change and backing off to every `REMODULE_MONITOR_POLL_MAX_MS` when idle.
+	 * A change is only reported once the file is unchanged for a poll interval, on top of @ref settle_ms.
+	 */
+	bool poll;
+} remodule_monitor_options_t;
+
+/**
+ * @brief Statistics of a monitor.
+ *
+ * @see remodule_monitor_stats
+ */
+typedef struct remodule_monitor_stats_s {
+	//! Number of file system events for the module.
+	uint32_t num_events;
+	//! Number of events which were coalesced with another one instead of causing their own reload.
+	uint32_t num_suppressed_events;
+	//! Number of times @link remodule_should_reload @endlink returned true.
+	uint32_t num_changes;
+} remodule_monitor_stats_t;
+
 /**
  * @brief Start monitoring.
  * @param mod A module obtained from @link remodule_load @endlink.
@@ -26,6 +69,25 @@ typedef struct remodule_monitor_s remodule_monitor_t;
 REMODULE_API remodule_monitor_t*
 remodule_monitor(remodule_t* mod);
 
+/**
+ * @brief Start monitoring with options.
+ *
+ * A change is only reported once the file has been left alone for @ref remodule_monitor_options_t::settle_ms and exists.
+ * This handles atomic-rename workflows: a file which is removed or renamed away within the window is ignored until it is replaced.
+ *
+ * @param mod A module obtained from @link remodule_load @endlink.
+ * @param options Options, `NULL` for the defaults.
+ * @return A monitor handle.
+ */
+REMODULE_API remodule_monitor_t*
+remodule_monitor_ex(remodule_t* mod, const remodule_monitor_options_t* options);
+
+/**
+ * @brief Get the statistics of a monitor.
+ */
+REMODULE_API const remodule_monitor_stats_t*
+remodule_monitor_stats(remodule_monitor_t* mon);
+
 /**
  * @brief Check for reload.
  *
@@ -33,6 +95,7 @@ remodule_monitor(remodule_t* mod);
  *
  * @param mon A monitor handle obtained from @link remodule_monitor @endlink.
  * @return Whether a reload happened.
+ *   This is false if the file was rewritten with identical content.
  */
 REMODULE_API bool
 remodule_check(remodule_monitor_t* mon);
@@ -56,17 +119,129 @@ remodule_should_reload(remodule_monitor_t* mon);
 REMODULE_API void
 remodule_unmonitor(remodule_monitor_t* mon);
 
+#if defined(_WIN32)
+//! A waitable handle, see @link remodule_monitor_handle @endlink.
+typedef void* remodule_monitor_handle_t;
+#else
+//! A pollable file descriptor, see @link remodule_monitor_handle @endlink.
+typedef int remodule_monitor_handle_t;
+#endif
+
+/**
+ * @brief Get the handle which is signaled when a monitored file changes.
+ *
+ * On Linux, this is a file descriptor which becomes readable and can be added to `epoll`, `poll` or `select`.
+ * On Windows, this is an I/O completion port.
+ *
+ * When it is signaled, call @link remodule_monitor_wait @endlink with a timeout of 0 to process the changes.
+ * Between changes, neither @link remodule_check @endlink nor @link remodule_should_reload @endlink need to be called.
+ *
+ * @return The handle, or -1 (`NULL` on Windows) if nothing is monitored.
+ *
+ * @remarks
+ *   The handle is created by the first @link remodule_monitor @endlink and closed by the last @link remodule_unmonitor @endlink.
+ *   It must not be read from or closed by the caller.
+ *
+ * @remarks
+ *   Polled files never signal the handle, see @link remodule_monitor_settle_timeout @endlink.
+ */
+REMODULE_API remodule_monitor_handle_t
+remodule_monitor_handle(void);
+
+/**
+ * @brief Wait for a monitored file to change.
+ *
+ * Pending changes are recorded so that the next @link remodule_check @endlink or @link remodule_should_reload @endlink of every monitor does not touch the file system again.
+ *
+ * @param timeout_ms How long to wait in milliseconds.
+ *   0 only processes pending changes without blocking.
+ *   A negative value waits forever.
+ * @return Whether a monitored file changed.
+ *
+ * @remarks
+ *   This returns false immediately if nothing is monitored.
+ *
+ * @remarks
+ *   Changes that have not settled yet are not reported but the wait is cut short when they do.
+ */
+REMODULE_API bool
+remodule_monitor_wait(int timeout_ms);
+
+/**
+ * @brief Get the time until a pending change settles or polled files are due for a check.
+ *
+ * Hosts waiting on @link remodule_monitor_handle @endlink should wake up after this long and call @link remodule_monitor_wait @endlink with a timeout of 0.
+ *
+ * @return The time in milliseconds, or -1 if no change is pending and no file is polled.
+ */
+REMODULE_API int
+remodule_monitor_settle_timeout(void);
+
+/**
+ * @brief Start a background thread which watches for changes.
+ *
+ * The thread takes over the file system notifications.
+ * @link remodule_should_reload @endlink and @link remodule_check @endlink then never make a syscall: they only compare the monitor's version with an atomic load.
+ * Different monitors can be checked from different threads.
+ *
+ * Every monitor whose module changed is also pushed to a lock-free queue, see @link remodule_monitor_next_change @endlink.
+ *
+ * @return Whether the thread was started.
+ *   This is false if it is already running.
+ *
+ * @remarks
+ *   @link remodule_monitor_wait @endlink must not be called while the thread is running.
+ */
+REMODULE_API bool
+remodule_monitor_start_thread(void);
+
+/**
+ * @brief Stop the thread started with @link remodule_monitor_start_thread @endlink.
+ */
+REMODULE_API void
+remodule_monitor_stop_thread(void);
+
+/**
+ * @brief Take the next monitor whose module changed.
+ *
+ * Monitors are only queued while the thread started with @link remodule_monitor_start_thread @endlink is running.
+ * A monitor is in the queue at most once until it is taken.
+ *
+ * @return A monitor, or `NULL` if nothing changed.
+ *
+ * @remarks
+ *   Only one thread may take from the queue.
+ *   A monitor is freed by @link remodule_unmonitor @endlink or, if it is queued at that point, when it is reached in the queue.
+ */
+REMODULE_API remodule_monitor_t*
+remodule_monitor_next_change(void);
+
+/**
+ * @brief Get the module of a monitor.
+ */
+REMODULE_API remodule_t*
+remodule_monitor_module(remodule_monitor_t* mon);
+
 #endif
 
 #ifdef REMODULE_MONITOR_IMPLEMENTATION
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 
 #if defined(__linux__)
 
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
 #include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <linux/limits.h>
 #include <unistd.h>
 #include <libgen.h>
@@ -78,8 +253,143 @@ remodule_unmonitor(remodule_monitor_t* mon);
 #endif
 
 #include <Windows.h>
+#include <ctype.h>
+#endif
+
+#define REMODULE_MONITOR_MIN_BUCKETS 16
+
+#ifndef REMODULE_MONITOR_EVENT_BUF_SIZE
+// Enough for hundreds of events per read, see remodule_dirmon_update_all
+#define REMODULE_MONITOR_EVENT_BUF_SIZE 65536
+#endif
+
+#ifndef REMODULE_MONITOR_POLL_MIN_MS
+#define REMODULE_MONITOR_POLL_MIN_MS 250
+#endif
+
+#ifndef REMODULE_MONITOR_POLL_MAX_MS
+// A stat of a cached inode is about a microsecond so a thousand idle polled
+// files cost well under 0.1% of a core
+#define REMODULE_MONITOR_POLL_MAX_MS 2000
+#endif
+
+#if defined(__linux__)
+
+typedef pthread_t remodule_monitor_thread_t;
+typedef pthread_mutex_t remodule_monitor_mutex_t;
+typedef atomic_int remodule_monitor_atomic_int_t;
+typedef _Atomic(remodule_monitor_t*) remodule_monitor_atomic_ptr_t;
+
+#define REMODULE_MONITOR_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+
+static void
+remodule_monitor_lock(remodule_monitor_mutex_t* mutex) {
+	pthread_mutex_lock(mutex);
+}
+
+static void
+remodule_monitor_unlock(remodule_monitor_mutex_t* mutex) {
+	pthread_mutex_unlock(mutex);
+}
+
+static int
+remodule_monitor_atomic_load(remodule_monitor_atomic_int_t* atomic) {
+	return atomic_load_explicit(atomic, memory_order_acquire);
+}
+
+static void
+remodule_monitor_atomic_store(remodule_monitor_atomic_int_t* atomic, int value) {
+	atomic_store_explicit(atomic, value, memory_order_release);
+}
+
+static void
+remodule_monitor_atomic_increment(remodule_monitor_atomic_int_t* atomic) {
+	atomic_fetch_add_explicit(atomic, 1, memory_order_release);
+}
+
+static int
+remodule_monitor_atomic_exchange(remodule_monitor_atomic_int_t* atomic, int value) {
+	return atomic_exchange(atomic, value);
+}
+
+static remodule_monitor_t*
+remodule_monitor_atomic_ptr_load(remodule_monitor_atomic_ptr_t* atomic) {
+	return atomic_load(atomic);
+}
+
+static bool
+remodule_monitor_atomic_ptr_cas(remodule_monitor_atomic_ptr_t* atomic, remodule_monitor_t* expected, remodule_monitor_t* value) {
+	return atomic_compare_exchange_strong(atomic, &expected, value);
+}
+
+static remodule_monitor_t*
+remodule_monitor_atomic_ptr_exchange(remodule_monitor_atomic_ptr_t* atomic, remodule_monitor_t* value) {
+	return atomic_exchange(atomic, value);
+}
+
+#elif defined(_WIN32)
+
+typedef HANDLE remodule_monitor_thread_t;
+typedef SRWLOCK remodule_monitor_mutex_t;
+typedef volatile LONG remodule_monitor_atomic_int_t;
+typedef remodule_monitor_t* volatile remodule_monitor_atomic_ptr_t;
+
+#define REMODULE_MONITOR_MUTEX_INIT SRWLOCK_INIT
+
+static void
+remodule_monitor_lock(remodule_monitor_mutex_t* mutex) {
+	AcquireSRWLockExclusive(mutex);
+}
+
+static void
+remodule_monitor_unlock(remodule_monitor_mutex_t* mutex) {
+	ReleaseSRWLockExclusive(mutex);
+}
+
+static int
+remodule_monitor_atomic_load(remodule_monitor_atomic_int_t* atomic) {
+	return (int)InterlockedCompareExchange(atomic, 0, 0);
+}
+
+static void
+remodule_monitor_atomic_store(remodule_monitor_atomic_int_t* atomic, int value) {
+	InterlockedExchange(atomic, value);
+}
+
+static void
+remodule_monitor_atomic_increment(remodule_monitor_atomic_int_t* atomic) {
+	InterlockedIncrement(atomic);
+}
+
+static int
+remodule_monitor_atomic_exchange(remodule_monitor_atomic_int_t* atomic, int value) {
+	return (int)InterlockedExchange(atomic, value);
+}
+
+static remodule_monitor_t*
+remodule_monitor_atomic_ptr_load(remodule_monitor_atomic_ptr_t* atomic) {
+	return InterlockedCompareExchangePointer((void* volatile*)atomic, NULL, NULL);
+}
+
+static bool
+remodule_monitor_atomic_ptr_cas(remodule_monitor_atomic_ptr_t* atomic, remodule_monitor_t* expected, remodule_monitor_t* value) {
+	return InterlockedCompareExchangePointer((void* volatile*)atomic, value, expected) == expected;
+}
+
+static remodule_monitor_t*
+remodule_monitor_atomic_ptr_exchange(remodule_monitor_atomic_ptr_t* atomic, remodule_monitor_t* value) {
+	return InterlockedExchangePointer((void* volatile*)atomic, value);
+}
+
 #endif
 
+enum {
+	REMODULE_MONITOR_IDLE,
+	REMODULE_MONITOR_QUEUED,
+	// Unmonitored while queued, freed when taken from the queue
+	REMODULE_MONITOR_REMOVED,
+};
+
 typedef struct remodule_dirmon_link_s {
 	struct remodule_dirmon_link_s* next;
 	struct remodule_dirmon_link_s* prev;
@@ -92,13 +402,22 @@ typedef struct remodule_monitor_link_s {
 
 typedef struct remodule_dirmon_s {
 	remodule_dirmon_link_t link;
-	remodule_monitor_link_t monitors;
-
+	// Chains in the hash tables of remodule_dirmon_root
+	struct remodule_dirmon_s* next_by_path;
+	struct remodule_dirmon_s* next_by_watch;
+	uint32_t path_hash;
+
+	// Hash table of monitors, keyed by file name
+	remodule_monitor_t** monitors;
+	int num_monitor_buckets;
 	int num_monitors;
+	// Not watched, all its monitors are polled
+	bool polled;
 
 #if defined(__linux__)
 	int watchd;
 #elif defined(_WIN32)
+	ULONG_PTR watch_key;
 	HANDLE dir_handle;
 	OVERLAPPED overlapped;
 	_Alignas(FILE_NOTIFY_INFORMATION) char notification_buf[sizeof(FILE_NOTIFY_INFORMATION) + MAX_PATH];
@@ -110,34 +429,103 @@ typedef struct remodule_dirmon_root_s {
 	remodule_dirmon_link_t link;
 	int version;
 
+	// Hash tables of directories, keyed by path and by watch
+	remodule_dirmon_t** dirmons_by_path;
+	remodule_dirmon_t** dirmons_by_watch;
+	int num_dirmon_buckets;
+	int num_dirmons;
+
+	// Monitors with a change that has not settled yet
+	remodule_monitor_link_t pending;
+
+	// Monitors checked with stat
+	remodule_monitor_link_t polled;
+	int poll_interval_ms;
+	uint64_t next_poll_ms;
+
+	// Everything above is guarded by this
+	remodule_monitor_mutex_t mutex;
+
+	// Watcher thread
+	remodule_monitor_thread_t watcher;
+	remodule_monitor_atomic_int_t watching;
+	bool stop_watcher;
+
+	// Changed monitors pushed by the watcher, most recent first
+	remodule_monitor_atomic_ptr_t changes;
+	// Changes taken by the consumer, oldest first
+	remodule_monitor_t* taken_changes;
+
 #if defined(__linux__)
 	int inotifyfd;
+	int wakefd;
+	_Alignas(struct inotify_event) char event_buf[REMODULE_MONITOR_EVENT_BUF_SIZE];
 #elif defined(_WIN32)
 	HANDLE iocp;
+	ULONG_PTR next_watch_key;
 #endif
 } remodule_dirmon_root_t;
 
 static remodule_dirmon_root_t remodule_dirmon_root = {
+	.mutex = REMODULE_MONITOR_MUTEX_INIT,
 #if defined(__linux__)
 	.inotifyfd = -1,
+	.wakefd = -1,
 #elif defined(_WIN32)
 	.iocp = NULL,
 #endif
 	.link = {
 		.next = &remodule_dirmon_root.link,
 		.prev = &remodule_dirmon_root.link,
-	}
+	},
+	.pending = {
+		.next = &remodule_dirmon_root.pending,
+		.prev = &remodule_dirmon_root.pending,
+	},
+	.polled = {
+		.next = &remodule_dirmon_root.polled,
+		.prev = &remodule_dirmon_root.polled,
+	},
 };
 
+typedef struct remodule_monitor_file_info_s {
+	bool exists;
+	uint64_t mtime;
+	uint64_t size;
+	uint64_t inode;
+} remodule_monitor_file_info_t;
+
 struct remodule_monitor_s {
-	remodule_monitor_link_t link;
+	// Chain in the hash table of dirmon
+	remodule_monitor_t* next;
+	uint32_t name_hash;
+	int name_length;
 
+	// Owned by the checking thread
 	int loaded_version;
-	int latest_version;
 	int root_version;
+	uint32_t num_changes;
+	uint32_t num_coalesced_changes;
+	remodule_monitor_stats_t stats_copy;
+
+	remodule_monitor_atomic_int_t latest_version;
 	remodule_dirmon_t* dirmon;
 	remodule_t* mod;
 
+	// Link in remodule_dirmon_root.pending, NULL when nothing is pending
+	remodule_monitor_link_t pending;
+	uint64_t last_event_ms;
+	int settle_ms;
+	remodule_monitor_stats_t stats;
+
+	// Link in remodule_dirmon_root.changes
+	remodule_monitor_t* next_change;
+	remodule_monitor_atomic_int_t queue_state;
+
+	// Link in remodule_dirmon_root.polled, NULL when notified instead
+	remodule_monitor_link_t polled;
+	remodule_monitor_file_info_t file_info;
+
 #if defined(__linux__)
 	char name[];
 #elif defined(_WIN32)
@@ -145,56 +533,477 @@ struct remodule_monitor_s {
 #endif
 };
 
+static uint64_t
+remodule_monitor_now_ms(void) {
+#if defined(__linux__)
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000ull + (uint64_t)now.tv_nsec / 1000000ull;
+#elif defined(_WIN32)
+	return GetTickCount64();
+#endif
+}
+
+static uint32_t
+remodule_monitor_hash(const void* data, size_t size) {
+	// FNV-1a
+	const unsigned char* bytes = data;
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static uint32_t
+remodule_dirmon_hash_path(const char* path) {
+	uint32_t hash = 2166136261u;
+	for (; *path != '\0'; ++path) {
+#if defined(_WIN32)
+		// Paths are compared with _stricmp
+		hash ^= (unsigned char)tolower((unsigned char)*path);
+#else
+		hash ^= (unsigned char)*path;
+#endif
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static size_t
+remodule_dirmon_watch_key(const remodule_dirmon_t* dirmon) {
+#if defined(__linux__)
+	// Watch descriptors are small integers handed out in sequence so they
+	// are used as is
+	return (size_t)dirmon->watchd;
+#elif defined(_WIN32)
+	return (size_t)dirmon->watch_key;
+#endif
+}
+
+static void
+remodule_dirmon_rehash(int num_buckets) {
+	free(remodule_dirmon_root.dirmons_by_path);
+	free(remodule_dirmon_root.dirmons_by_watch);
+	remodule_dirmon_root.dirmons_by_path = calloc(num_buckets, sizeof(remodule_dirmon_t*));
+	remodule_dirmon_root.dirmons_by_watch = calloc(num_buckets, sizeof(remodule_dirmon_t*));
+	remodule_dirmon_root.num_dirmon_buckets = num_buckets;
+
+	for (
+		remodule_dirmon_link_t* itr = remodule_dirmon_root.link.next;
+		itr != &remodule_dirmon_root.link;
+		itr = itr->next
+	) {
+		remodule_dirmon_t* dirmon = (remodule_dirmon_t*)((char*)itr - offsetof(remodule_dirmon_t, link));
+
+		size_t path_bucket = dirmon->path_hash & (num_buckets - 1);
+		dirmon->next_by_path = remodule_dirmon_root.dirmons_by_path[path_bucket];
+		remodule_dirmon_root.dirmons_by_path[path_bucket] = dirmon;
+
+		size_t watch_bucket = remodule_dirmon_watch_key(dirmon) & (num_buckets - 1);
+		dirmon->next_by_watch = remodule_dirmon_root.dirmons_by_watch[watch_bucket];
+		remodule_dirmon_root.dirmons_by_watch[watch_bucket] = dirmon;
+	}
+}
+
+static remodule_dirmon_t*
+remodule_dirmon_find_by_path(const char* path, uint32_t path_hash) {
+	if (remodule_dirmon_root.num_dirmon_buckets == 0) { return NULL; }
+
+	size_t bucket = path_hash & (remodule_dirmon_root.num_dirmon_buckets - 1);
+	for (
+		remodule_dirmon_t* itr = remodule_dirmon_root.dirmons_by_path[bucket];
+		itr != NULL;
+		itr = itr->next_by_path
+	) {
+#if defined(__linux__)
+		if (itr->path_hash == path_hash && strcmp(path, itr->path) == 0) {
+#elif defined(_WIN32)
+		if (itr->path_hash == path_hash && _stricmp(path, itr->path) == 0) {
+#endif
+			return itr;
+		}
+	}
+
+	return NULL;
+}
+
+static remodule_dirmon_t*
+remodule_dirmon_find_by_watch(size_t watch_key) {
+	if (remodule_dirmon_root.num_dirmon_buckets == 0) { return NULL; }
+
+	size_t bucket = watch_key & (remodule_dirmon_root.num_dirmon_buckets - 1);
+	for (
+		remodule_dirmon_t* itr = remodule_dirmon_root.dirmons_by_watch[bucket];
+		itr != NULL;
+		itr = itr->next_by_watch
+	) {
+		if (remodule_dirmon_watch_key(itr) == watch_key) {
+			return itr;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+remodule_dirmon_insert(remodule_dirmon_t* dirmon) {
+	dirmon->link.next = remodule_dirmon_root.link.next;
+	remodule_dirmon_root.link.next->prev = &dirmon->link;
+	dirmon->link.prev = &remodule_dirmon_root.link;
+	remodule_dirmon_root.link.next = &dirmon->link;
+
+	if (++remodule_dirmon_root.num_dirmons > remodule_dirmon_root.num_dirmon_buckets) {
+		// Rehashing also inserts the new directory
+		int num_buckets = remodule_dirmon_root.num_dirmon_buckets * 2;
+		remodule_dirmon_rehash(
+			num_buckets > REMODULE_MONITOR_MIN_BUCKETS ? num_buckets : REMODULE_MONITOR_MIN_BUCKETS
+		);
+	} else {
+		int num_buckets = remodule_dirmon_root.num_dirmon_buckets;
+
+		size_t path_bucket = dirmon->path_hash & (num_buckets - 1);
+		dirmon->next_by_path = remodule_dirmon_root.dirmons_by_path[path_bucket];
+		remodule_dirmon_root.dirmons_by_path[path_bucket] = dirmon;
+
+		size_t watch_bucket = remodule_dirmon_watch_key(dirmon) & (num_buckets - 1);
+		dirmon->next_by_watch = remodule_dirmon_root.dirmons_by_watch[watch_bucket];
+		remodule_dirmon_root.dirmons_by_watch[watch_bucket] = dirmon;
+	}
+}
+
+static void
+remodule_dirmon_remove(remodule_dirmon_t* dirmon) {
+	dirmon->link.next->prev = dirmon->link.prev;
+	dirmon->link.prev->next = dirmon->link.next;
+
+	int num_buckets = remodule_dirmon_root.num_dirmon_buckets;
+
+	remodule_dirmon_t** itr = &remodule_dirmon_root.dirmons_by_path[dirmon->path_hash & (num_buckets - 1)];
+	while (*itr != dirmon) { itr = &(*itr)->next_by_path; }
+	*itr = dirmon->next_by_path;
+
+	itr = &remodule_dirmon_root.dirmons_by_watch[remodule_dirmon_watch_key(dirmon) & (num_buckets - 1)];
+	while (*itr != dirmon) { itr = &(*itr)->next_by_watch; }
+	*itr = dirmon->next_by_watch;
+
+	free(dirmon->monitors);
+
+	if (--remodule_dirmon_root.num_dirmons == 0) {
+		free(remodule_dirmon_root.dirmons_by_path);
+		free(remodule_dirmon_root.dirmons_by_watch);
+		remodule_dirmon_root.dirmons_by_path = NULL;
+		remodule_dirmon_root.dirmons_by_watch = NULL;
+		remodule_dirmon_root.num_dirmon_buckets = 0;
+	}
+}
+
+static void
+remodule_dirmon_add_monitor(remodule_dirmon_t* dirmon, remodule_monitor_t* mon) {
+	// num_monitors was already incremented by remodule_dirmon_acquire
+	if (dirmon->num_monitors > dirmon->num_monitor_buckets) {
+		int num_buckets = dirmon->num_monitor_buckets * 2;
+		if (num_buckets < REMODULE_MONITOR_MIN_BUCKETS) { num_buckets = REMODULE_MONITOR_MIN_BUCKETS; }
+		remodule_monitor_t** buckets = calloc(num_buckets, sizeof(remodule_monitor_t*));
+
+		for (int i = 0; i < dirmon->num_monitor_buckets; ++i) {
+			remodule_monitor_t* itr = dirmon->monitors[i];
+			while (itr != NULL) {
+				remodule_monitor_t* next = itr->next;
+				size_t bucket = itr->name_hash & (num_buckets - 1);
+				itr->next = buckets[bucket];
+				buckets[bucket] = itr;
+				itr = next;
+			}
+		}
+
+		free(dirmon->monitors);
+		dirmon->monitors = buckets;
+		dirmon->num_monitor_buckets = num_buckets;
+	}
+
+	size_t bucket = mon->name_hash & (dirmon->num_monitor_buckets - 1);
+	mon->next = dirmon->monitors[bucket];
+	dirmon->monitors[bucket] = mon;
+}
+
+static void
+remodule_dirmon_remove_monitor(remodule_dirmon_t* dirmon, remodule_monitor_t* mon) {
+	remodule_monitor_t** itr = &dirmon->monitors[mon->name_hash & (dirmon->num_monitor_buckets - 1)];
+	while (*itr != mon) { itr = &(*itr)->next; }
+	*itr = mon->next;
+}
+
+static void
+remodule_monitor_record_event(remodule_monitor_t* mon, uint64_t now_ms) {
+	++mon->stats.num_events;
+	mon->last_event_ms = now_ms;
+
+	if (mon->pending.next != NULL) {
+		++mon->stats.num_suppressed_events;
+	} else {
+		mon->pending.next = &remodule_dirmon_root.pending;
+		mon->pending.prev = remodule_dirmon_root.pending.prev;
+		remodule_dirmon_root.pending.prev->next = &mon->pending;
+		remodule_dirmon_root.pending.prev = &mon->pending;
+	}
+}
+
+#if defined(_WIN32)
+
+static bool
+remodule_monitor_path(remodule_monitor_t* mon, wchar_t* path) {
+	// The directory path ends with a separator
+	int len = MultiByteToWideChar(CP_ACP, 0, mon->dirmon->path, -1, path, MAX_PATH);
+	if (len <= 0) { return false; }
+	memcpy(path + len - 1, mon->name, (mon->name_length + 1) * sizeof(wchar_t));
+	return true;
+}
+
+#endif
+
+static void
+remodule_dirmon_notify(remodule_dirmon_t* dirmon, const void* name, size_t name_size) {
+	if (dirmon->num_monitor_buckets == 0) { return; }
+
+	uint64_t now_ms = remodule_monitor_now_ms();
+	uint32_t name_hash = remodule_monitor_hash(name, name_size);
+	size_t bucket = name_hash & (dirmon->num_monitor_buckets - 1);
+	// Several monitors may watch the same file
+	for (
+		remodule_monitor_t* itr = dirmon->monitors[bucket];
+		itr != NULL;
+		itr = itr->next
+	) {
+		if (
+			itr->name_hash == name_hash
+			&& itr->name_length * sizeof(itr->name[0]) == name_size
+			&& memcmp(itr->name, name, name_size) == 0
+			&& itr->polled.next == NULL
+		) {
+			remodule_monitor_record_event(itr, now_ms);
+		}
+	}
+}
+
+static bool
+remodule_monitor_file_exists(remodule_monitor_t* mon) {
+#if defined(__linux__)
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", mon->dirmon->path, mon->name);
+	return access(path, F_OK) == 0;
+#elif defined(_WIN32)
+	wchar_t path[MAX_PATH * 2];
+	if (!remodule_monitor_path(mon, path)) { return false; }
+	return GetFileAttributesW(path) != INVALID_FILE_ATTRIBUTES;
+#endif
+}
+
+static remodule_monitor_file_info_t
+remodule_monitor_file_info(remodule_monitor_t* mon) {
+#if defined(__linux__)
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", mon->dirmon->path, mon->name);
+
+	struct stat st;
+	if (stat(path, &st) != 0) { return (remodule_monitor_file_info_t){ .exists = false }; }
+
+	return (remodule_monitor_file_info_t){
+		.exists = true,
+		.mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec,
+		.size = (uint64_t)st.st_size,
+		.inode = (uint64_t)st.st_ino,
+	};
+#elif defined(_WIN32)
+	wchar_t path[MAX_PATH * 2];
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (
+		!remodule_monitor_path(mon, path)
+		|| !GetFileAttributesExW(path, GetFileExInfoStandard, &data)
+	) {
+		return (remodule_monitor_file_info_t){ .exists = false };
+	}
+
+	// There is no inode without opening the file, a replacement changes the
+	// write time anyway
+	return (remodule_monitor_file_info_t){
+		.exists = true,
+		.mtime = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime,
+		.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow,
+	};
+#endif
+}
+
+static void
+remodule_monitor_poll_all(void) {
+	if (remodule_dirmon_root.polled.next == &remodule_dirmon_root.polled) { return; }
+
+	uint64_t now_ms = remodule_monitor_now_ms();
+	if (now_ms < remodule_dirmon_root.next_poll_ms) { return; }
+
+	bool changed = false;
+	for (
+		remodule_monitor_link_t* itr = remodule_dirmon_root.polled.next;
+		itr != &remodule_dirmon_root.polled;
+		itr = itr->next
+	) {
+		remodule_monitor_t* mon = (remodule_monitor_t*)((char*)itr - offsetof(remodule_monitor_t, polled));
+		remodule_monitor_file_info_t file_info = remodule_monitor_file_info(mon);
+		if (
+			file_info.exists != mon->file_info.exists
+			|| file_info.mtime != mon->file_info.mtime
+			|| file_info.size != mon->file_info.size
+			|| file_info.inode != mon->file_info.inode
+		) {
+			mon->file_info = file_info;
+			remodule_monitor_record_event(mon, now_ms);
+			changed = true;
+		}
+	}
+
+	// Poll quickly while files are being written and back off when idle
+	int interval_ms = changed ? REMODULE_MONITOR_POLL_MIN_MS : remodule_dirmon_root.poll_interval_ms * 2;
+	if (interval_ms < REMODULE_MONITOR_POLL_MIN_MS) { interval_ms = REMODULE_MONITOR_POLL_MIN_MS; }
+	if (interval_ms > REMODULE_MONITOR_POLL_MAX_MS) { interval_ms = REMODULE_MONITOR_POLL_MAX_MS; }
+	remodule_dirmon_root.poll_interval_ms = interval_ms;
+	remodule_dirmon_root.next_poll_ms = now_ms + interval_ms;
+}
+
+static void
+remodule_monitor_unlink_pending(remodule_monitor_t* mon) {
+	mon->pending.next->prev = mon->pending.prev;
+	mon->pending.prev->next = mon->pending.next;
+	mon->pending.next = mon->pending.prev = NULL;
+}
+
+static void
+remodule_monitor_enqueue(remodule_monitor_t* mon) {
+	if (
+		remodule_monitor_atomic_exchange(&mon->queue_state, REMODULE_MONITOR_QUEUED)
+		== REMODULE_MONITOR_QUEUED
+	) {
+		return;
+	}
+
+	remodule_monitor_t* head;
+	do {
+		head = remodule_monitor_atomic_ptr_load(&remodule_dirmon_root.changes);
+		mon->next_change = head;
+	} while (!remodule_monitor_atomic_ptr_cas(&remodule_dirmon_root.changes, head, mon));
+}
+
+static bool
+remodule_dirmon_settle(void) {
+	uint64_t now_ms = remodule_monitor_now_ms();
+	bool changed = false;
+
+	remodule_monitor_link_t* itr = remodule_dirmon_root.pending.next;
+	while (itr != &remodule_dirmon_root.pending) {
+		remodule_monitor_t* mon = (remodule_monitor_t*)((char*)itr - offsetof(remodule_monitor_t, pending));
+		itr = itr->next;
+
+		if (now_ms - mon->last_event_ms < (uint64_t)mon->settle_ms) { continue; }
+
+		remodule_monitor_unlink_pending(mon);
+		if (remodule_monitor_file_exists(mon)) {
+			remodule_monitor_atomic_increment(&mon->latest_version);
+			if (remodule_monitor_atomic_load(&remodule_dirmon_root.watching)) {
+				remodule_monitor_enqueue(mon);
+			}
+			changed = true;
+		} else {
+			// Removed or renamed away, its replacement will be another event
+			++mon->stats.num_suppressed_events;
+		}
+	}
+
+	return changed;
+}
+
+static int
+remodule_dirmon_settle_timeout(void);
+
+static void
+remodule_dirmon_watch(void);
+
 #if defined(__linux__)
 
+static void
+remodule_dirmon_open(void) {
+	if (remodule_dirmon_root.inotifyfd < 0) {
+		remodule_dirmon_root.inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		REMODULE_ASSERT(remodule_dirmon_root.inotifyfd > 0, "Could not create inotify");
+	}
+}
+
+static void
+remodule_dirmon_close(void) {
+	// The watcher keeps polling it until it is stopped
+	if (
+		remodule_dirmon_root.link.next == &remodule_dirmon_root.link
+		&& !remodule_monitor_atomic_load(&remodule_dirmon_root.watching)
+		&& remodule_dirmon_root.inotifyfd >= 0
+	) {
+		close(remodule_dirmon_root.inotifyfd);
+		remodule_dirmon_root.inotifyfd = -1;
+	}
+}
+
+static bool
+remodule_dirmon_is_remote(const char* path) {
+	struct statfs stfs;
+	if (statfs(path, &stfs) != 0) { return false; }
+
+	// Changes made by other hosts or by a FUSE daemon are not notified
+	switch ((unsigned long)stfs.f_type) {
+		case NFS_SUPER_MAGIC:
+		case SMB_SUPER_MAGIC:
+		case 0xFF534D42: // CIFS
+		case 0xFE534D42: // SMB2
+		case V9FS_MAGIC:
+		case CEPH_SUPER_MAGIC:
+		case AFS_SUPER_MAGIC:
+		case FUSE_SUPER_MAGIC:
+			return true;
+		default:
+			return false;
+	}
+}
+
 static remodule_dirmon_t*
 remodule_dirmon_acquire(const char* path) {
 	char* real_path = realpath(path, NULL);
 	char* dir_name = dirname(real_path);
+	uint32_t path_hash = remodule_dirmon_hash_path(dir_name);
 
-	remodule_dirmon_t* dirmon = NULL;
-	for (
-		remodule_dirmon_link_t* itr = remodule_dirmon_root.link.next;
-		itr != &remodule_dirmon_root.link;
-		itr = itr->next
-	) {
-		remodule_dirmon_t* dirmon_itr = (remodule_dirmon_t*)((char*)itr - offsetof(remodule_dirmon_t, link));
-		if (strcmp(dir_name, dirmon_itr->path) == 0) {
-			++dirmon_itr->num_monitors;
-			dirmon = dirmon_itr;
-			break;
-		}
-	}
-
-	if (dirmon == NULL) {
-		if (remodule_dirmon_root.inotifyfd < 0) {
-			remodule_dirmon_root.inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
-			REMODULE_ASSERT(remodule_dirmon_root.inotifyfd > 0, "Could not create inotify");
+	remodule_dirmon_t* dirmon = remodule_dirmon_find_by_path(dir_name, path_hash);
+	if (dirmon != NULL) {
+		++dirmon->num_monitors;
+	} else {
+		int watchd = -1;
+		if (!remodule_dirmon_is_remote(dir_name)) {
+			remodule_dirmon_open();
+			// Out of watches, fall back to polling
+			watchd = inotify_add_watch(
+				remodule_dirmon_root.inotifyfd,
+				dir_name,
+				IN_CLOSE_WRITE | IN_MOVED_TO
+			);
 		}
 
-		int watchd = inotify_add_watch(
-			remodule_dirmon_root.inotifyfd,
-			dir_name,
-			IN_CLOSE_WRITE | IN_MOVED_TO
-		);
-		REMODULE_ASSERT(watchd, "Could not add watch");
-
 		size_t dir_name_len = strlen(dir_name);
 		dirmon = malloc(sizeof(remodule_dirmon_t) + dir_name_len + 1);
 		*dirmon = (remodule_dirmon_t){
+			.path_hash = path_hash,
 			.num_monitors = 1,
+			.polled = watchd < 0,
 			.watchd = watchd,
 		};
 		memcpy(dirmon->path, dir_name, dir_name_len);
 		dirmon->path[dir_name_len] = '\0';
 
-		dirmon->link.next = remodule_dirmon_root.link.next;
-		remodule_dirmon_root.link.next->prev = &dirmon->link;
-		dirmon->link.prev = &remodule_dirmon_root.link;
-		remodule_dirmon_root.link.next = &dirmon->link;
-
-		dirmon->monitors.next = &dirmon->monitors;
-		dirmon->monitors.prev = &dirmon->monitors;
+		remodule_dirmon_insert(dirmon);
 	}
 
 	free(real_path);
@@ -205,23 +1014,20 @@ static void
 remodule_dirmon_release(remodule_dirmon_t* dirmon) {
 	if (--dirmon->num_monitors > 0) { return; }
 
-	dirmon->link.next->prev = dirmon->link.prev;
-	dirmon->link.prev->next = dirmon->link.next;
-	inotify_rm_watch(remodule_dirmon_root.inotifyfd, dirmon->watchd);
-	free(dirmon);
-
-	if (remodule_dirmon_root.link.next == &remodule_dirmon_root.link) {
-		close(remodule_dirmon_root.inotifyfd);
-		remodule_dirmon_root.inotifyfd = -1;
+	remodule_dirmon_remove(dirmon);
+	if (!dirmon->polled) {
+		inotify_rm_watch(remodule_dirmon_root.inotifyfd, dirmon->watchd);
 	}
+	free(dirmon);
+	remodule_dirmon_close();
 }
 
-static void
+static bool
 remodule_dirmon_update_all(void) {
-	_Alignas(struct inotify_event) char event_buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+	char* event_buf = remodule_dirmon_root.event_buf;
 
-	while (true) {
-		ssize_t num_bytes_read = read(remodule_dirmon_root.inotifyfd, event_buf, sizeof(event_buf));
+	while (remodule_dirmon_root.inotifyfd >= 0) {
+		ssize_t num_bytes_read = read(remodule_dirmon_root.inotifyfd, event_buf, REMODULE_MONITOR_EVENT_BUF_SIZE);
 
 		if (num_bytes_read <= 0) {
 			break;
@@ -234,55 +1040,79 @@ remodule_dirmon_update_all(void) {
 			struct inotify_event* event = (struct inotify_event*)event_itr;
 			event_itr += sizeof(struct inotify_event) + event->len;
 
-			for (
-				remodule_dirmon_link_t* itr = remodule_dirmon_root.link.next;
-				itr != &remodule_dirmon_root.link;
-				itr = itr->next
-			) {
-				remodule_dirmon_t* dirmon = (remodule_dirmon_t*)((char*)itr - offsetof(remodule_dirmon_t, link));
-
-				if (dirmon->watchd == event->wd) {
-					for (
-						remodule_monitor_link_t* mon_itr = dirmon->monitors.next;
-						mon_itr != &dirmon->monitors;
-						mon_itr = mon_itr->next
-					) {
-						remodule_monitor_t* monitor = (remodule_monitor_t*)((char*)mon_itr - offsetof(remodule_monitor_t, link));
-						if (strcmp(monitor->name, event->name) == 0) {
-							++monitor->latest_version;
-						}
-					}
-
-					break;
-				}
+			// Overflow and other queue events have no watch or no name
+			if (event->wd < 0 || event->len == 0) { continue; }
+
+			remodule_dirmon_t* dirmon = remodule_dirmon_find_by_watch((size_t)event->wd);
+			if (dirmon != NULL) {
+				remodule_dirmon_notify(dirmon, event->name, strlen(event->name));
 			}
 		}
+
+		// A read only stops short when the queue is empty, skip the read that would fail
+		if (
+			(size_t)num_bytes_read
+			<= REMODULE_MONITOR_EVENT_BUF_SIZE - (sizeof(struct inotify_event) + NAME_MAX + 1)
+		) {
+			break;
+		}
 	}
 
+	remodule_monitor_poll_all();
 	++remodule_dirmon_root.version;
+	return remodule_dirmon_settle();
 }
 
-#elif defined(_WIN32)
+static void
+remodule_dirmon_poll(int timeout_ms) {
+	// A negative file descriptor is ignored, leaving a sleep for polled files
+	struct pollfd pollfds[] = {
+		{ .fd = remodule_dirmon_root.inotifyfd, .events = POLLIN },
+		{ .fd = remodule_dirmon_root.wakefd, .events = POLLIN },
+	};
+	poll(pollfds, remodule_dirmon_root.wakefd >= 0 ? 2 : 1, timeout_ms);
 
-static remodule_dirmon_t*
-remodule_dirmon_acquire(const char* path) {
-	char name_buf[MAX_PATH];
-	char* file_part;
-	GetFullPathNameA(path, sizeof(name_buf), name_buf, &file_part);
-	*file_part = '\0';
+	if (pollfds[1].revents & POLLIN) {
+		uint64_t value;
+		(void)!read(remodule_dirmon_root.wakefd, &value, sizeof(value));
+	}
+}
 
-	for (
-		remodule_dirmon_link_t* itr = remodule_dirmon_root.link.next;
-		itr != &remodule_dirmon_root.link;
-		itr = itr->next
-	) {
-		remodule_dirmon_t* dirmon = (remodule_dirmon_t*)((char*)itr - offsetof(remodule_dirmon_t, link));
-		if (_stricmp(name_buf, dirmon->path) == 0) {
-			++dirmon->num_monitors;
-			return dirmon;
-		}
+static void*
+remodule_dirmon_watch_entry(void* arg) {
+	(void)arg;
+	remodule_dirmon_watch();
+	return NULL;
+}
+
+static bool
+remodule_dirmon_start_watcher(void) {
+	remodule_dirmon_root.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (remodule_dirmon_root.wakefd < 0) { return false; }
+
+	if (pthread_create(&remodule_dirmon_root.watcher, NULL, remodule_dirmon_watch_entry, NULL) != 0) {
+		close(remodule_dirmon_root.wakefd);
+		remodule_dirmon_root.wakefd = -1;
+		return false;
 	}
 
+	return true;
+}
+
+static void
+remodule_dirmon_stop_watcher(void) {
+	uint64_t value = 1;
+	(void)!write(remodule_dirmon_root.wakefd, &value, sizeof(value));
+	pthread_join(remodule_dirmon_root.watcher, NULL);
+
+	close(remodule_dirmon_root.wakefd);
+	remodule_dirmon_root.wakefd = -1;
+}
+
+#elif defined(_WIN32)
+
+static void
+remodule_dirmon_open(void) {
 	if (remodule_dirmon_root.iocp == NULL) {
 		remodule_dirmon_root.iocp = CreateIoCompletionPort(
 			INVALID_HANDLE_VALUE,
@@ -292,49 +1122,84 @@ remodule_dirmon_acquire(const char* path) {
 		);
 		REMODULE_ASSERT(remodule_dirmon_root.iocp != NULL, "Could not create IOCP");
 	}
+}
+
+static void
+remodule_dirmon_close(void) {
+	// The watcher keeps waiting on it until it is stopped
+	if (
+		remodule_dirmon_root.link.next == &remodule_dirmon_root.link
+		&& !remodule_monitor_atomic_load(&remodule_dirmon_root.watching)
+		&& remodule_dirmon_root.iocp != NULL
+	) {
+		CloseHandle(remodule_dirmon_root.iocp);
+		remodule_dirmon_root.iocp = NULL;
+	}
+}
+
+static bool
+remodule_dirmon_is_remote(const char* path) {
+	// Changes made by other hosts are not always notified
+	char volume_buf[MAX_PATH];
+	if (!GetVolumePathNameA(path, volume_buf, sizeof(volume_buf))) { return false; }
+	return GetDriveTypeA(volume_buf) == DRIVE_REMOTE;
+}
+
+static remodule_dirmon_t*
+remodule_dirmon_acquire(const char* path) {
+	char name_buf[MAX_PATH];
+	char* file_part;
+	GetFullPathNameA(path, sizeof(name_buf), name_buf, &file_part);
+	*file_part = '\0';
+	uint32_t path_hash = remodule_dirmon_hash_path(name_buf);
+
+	remodule_dirmon_t* existing_dirmon = remodule_dirmon_find_by_path(name_buf, path_hash);
+	if (existing_dirmon != NULL) {
+		++existing_dirmon->num_monitors;
+		return existing_dirmon;
+	}
 
 	size_t dir_name_len = strlen(name_buf);
 	remodule_dirmon_t* dirmon = malloc(
 		sizeof(remodule_dirmon_t) + dir_name_len + 1
 	);
 	*dirmon = (remodule_dirmon_t){
+		.path_hash = path_hash,
 		.num_monitors = 1,
+		// Completions of a released directory may still be queued so they
+		// are matched with a key that is never reused
+		.watch_key = ++remodule_dirmon_root.next_watch_key,
+		.dir_handle = INVALID_HANDLE_VALUE,
 	};
 
-	dirmon->link.next = remodule_dirmon_root.link.next;
-	remodule_dirmon_root.link.next->prev = &dirmon->link;
-	dirmon->link.prev = &remodule_dirmon_root.link;
-	remodule_dirmon_root.link.next = &dirmon->link;
-
-	dirmon->monitors.next = &dirmon->monitors;
-	dirmon->monitors.prev = &dirmon->monitors;
-
 	memcpy(dirmon->path, name_buf, dir_name_len);
 	dirmon->path[dir_name_len] = '\0';
 
-	dirmon->dir_handle = CreateFileA(
-		name_buf,
-		FILE_LIST_DIRECTORY,
-		FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
-		NULL,
-		OPEN_EXISTING,
-		FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
-		NULL
-	);
-	REMODULE_ASSERT(dirmon->dir_handle != INVALID_HANDLE_VALUE, "Could not open directory");
+	remodule_dirmon_insert(dirmon);
 
-	REMODULE_ASSERT(
-		CreateIoCompletionPort(
+	if (!remodule_dirmon_is_remote(name_buf)) {
+		remodule_dirmon_open();
+		dirmon->dir_handle = CreateFileA(
+			name_buf,
+			FILE_LIST_DIRECTORY,
+			FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
+			NULL,
+			OPEN_EXISTING,
+			FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+			NULL
+		);
+	}
+
+	// Fall back to polling when the directory cannot be watched
+	dirmon->polled =
+		dirmon->dir_handle == INVALID_HANDLE_VALUE
+		|| CreateIoCompletionPort(
 			dirmon->dir_handle,
 			remodule_dirmon_root.iocp,
-			0,
+			dirmon->watch_key,
 			1
-		) != NULL,
-		"Could not associate directory to IOCP"
-	);
-
-	REMODULE_ASSERT(
-		ReadDirectoryChangesW(
+		) == NULL
+		|| !ReadDirectoryChangesW(
 			dirmon->dir_handle,
 			dirmon->notification_buf,
 			sizeof(dirmon->notification_buf),
@@ -345,9 +1210,11 @@ remodule_dirmon_acquire(const char* path) {
 			NULL,
 			&dirmon->overlapped,
 			NULL
-		),
-		"ReadDirectoryChangesW failed"
-	);
+		);
+	if (dirmon->polled && dirmon->dir_handle != INVALID_HANDLE_VALUE) {
+		CloseHandle(dirmon->dir_handle);
+		dirmon->dir_handle = INVALID_HANDLE_VALUE;
+	}
 
 	return dirmon;
 }
@@ -356,86 +1223,122 @@ static void
 remodule_dirmon_release(remodule_dirmon_t* dirmon) {
 	if (--dirmon->num_monitors > 0) { return; }
 
-	dirmon->link.next->prev = dirmon->link.prev;
-	dirmon->link.prev->next = dirmon->link.next;
-	CancelIo(dirmon->dir_handle);
-	CloseHandle(dirmon->dir_handle);
+	remodule_dirmon_remove(dirmon);
+	if (!dirmon->polled) {
+		CancelIo(dirmon->dir_handle);
+		CloseHandle(dirmon->dir_handle);
+	}
 	free(dirmon);
+	remodule_dirmon_close();
+}
 
-	if (remodule_dirmon_root.link.next == &remodule_dirmon_root.link) {
-		CloseHandle(remodule_dirmon_root.iocp);
-		remodule_dirmon_root.iocp = NULL;
+static void
+remodule_dirmon_complete(ULONG_PTR key, OVERLAPPED* overlapped) {
+	remodule_dirmon_t* dirmon = remodule_dirmon_find_by_watch((size_t)key);
+	if (dirmon == NULL || &dirmon->overlapped != overlapped) { return; }
+
+	FILE_NOTIFY_INFORMATION* notification_itr = (FILE_NOTIFY_INFORMATION*)dirmon->notification_buf;
+	while (true) {
+		remodule_dirmon_notify(
+			dirmon,
+			notification_itr->FileName,
+			notification_itr->FileNameLength
+		);
+
+		if (notification_itr->NextEntryOffset == 0) {
+			break;
+		} else {
+			notification_itr = (FILE_NOTIFY_INFORMATION*)(
+				(char*)notification_itr + notification_itr->NextEntryOffset
+			);
+		}
 	}
+
+	// Queue another read
+	REMODULE_ASSERT(
+		ReadDirectoryChangesW(
+			dirmon->dir_handle,
+			dirmon->notification_buf,
+			sizeof(dirmon->notification_buf),
+			FALSE,
+			FILE_NOTIFY_CHANGE_FILE_NAME
+			| FILE_NOTIFY_CHANGE_LAST_WRITE
+			| FILE_NOTIFY_CHANGE_CREATION,
+			NULL,
+			&dirmon->overlapped,
+			NULL
+		),
+		"ReadDirectoryChangesW failed"
+	);
 }
 
-static void
+static bool
 remodule_dirmon_update_all(void) {
 	DWORD num_bytes;
 	ULONG_PTR key;
 	OVERLAPPED* overlapped;
 
-	while (GetQueuedCompletionStatus(remodule_dirmon_root.iocp, &num_bytes, &key, &overlapped, 0)) {
-		for (
-			remodule_dirmon_link_t* itr = remodule_dirmon_root.link.next;
-			itr != &remodule_dirmon_root.link;
-			itr = itr->next
-		) {
-			remodule_dirmon_t* dirmon = (remodule_dirmon_t*)((char*)itr - offsetof(remodule_dirmon_t, link));
-
-			if (&dirmon->overlapped == overlapped) {
-				FILE_NOTIFY_INFORMATION* notification_itr = (FILE_NOTIFY_INFORMATION*)dirmon->notification_buf;
-				while (true) {
-					for (
-						remodule_monitor_link_t* mon_itr = dirmon->monitors.next;
-						mon_itr != &dirmon->monitors;
-						mon_itr = mon_itr->next
-					) {
-						remodule_monitor_t* monitor = (remodule_monitor_t*)((char*)mon_itr - offsetof(remodule_monitor_t, link));
-						if (wcsncmp(monitor->name, notification_itr->FileName, notification_itr->FileNameLength / sizeof(wchar_t)) == 0) {
-							++monitor->latest_version;
-						}
-					}
-
-					if (notification_itr->NextEntryOffset == 0) {
-						break;
-					} else {
-						notification_itr = (FILE_NOTIFY_INFORMATION*)(
-							(char*)notification_itr + notification_itr->NextEntryOffset
-						);
-					}
-				}
-
-				// Queue another read
-				REMODULE_ASSERT(
-					ReadDirectoryChangesW(
-						dirmon->dir_handle,
-						dirmon->notification_buf,
-						sizeof(dirmon->notification_buf),
-						FALSE,
-						FILE_NOTIFY_CHANGE_FILE_NAME
-						| FILE_NOTIFY_CHANGE_LAST_WRITE
-						| FILE_NOTIFY_CHANGE_CREATION,
-						NULL,
-						&dirmon->overlapped,
-						NULL
-					),
-					"ReadDirectoryChangesW failed"
-				);
-				break;
-			}
-		}
+	while (
+		remodule_dirmon_root.iocp != NULL
+		&& GetQueuedCompletionStatus(remodule_dirmon_root.iocp, &num_bytes, &key, &overlapped, 0)
+	) {
+		remodule_dirmon_complete(key, overlapped);
 	}
 
+	remodule_monitor_poll_all();
 	++remodule_dirmon_root.version;
+	return remodule_dirmon_settle();
+}
+
+static void
+remodule_dirmon_poll(int timeout_ms) {
+	// Only polled files
+	if (remodule_dirmon_root.iocp == NULL) {
+		Sleep(timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms);
+		return;
+	}
+
+	DWORD num_bytes;
+	ULONG_PTR key;
+	OVERLAPPED* overlapped;
+	if (GetQueuedCompletionStatus(
+		remodule_dirmon_root.iocp,
+		&num_bytes, &key, &overlapped,
+		timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms
+	)) {
+		// Wake ups from remodule_dirmon_stop_watcher have no dirmon
+		remodule_monitor_lock(&remodule_dirmon_root.mutex);
+		remodule_dirmon_complete(key, overlapped);
+		remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+	}
+}
+
+static DWORD WINAPI
+remodule_dirmon_watch_entry(LPVOID arg) {
+	(void)arg;
+	remodule_dirmon_watch();
+	return 0;
+}
+
+static bool
+remodule_dirmon_start_watcher(void) {
+	remodule_dirmon_root.watcher = CreateThread(NULL, 0, remodule_dirmon_watch_entry, NULL, 0, NULL);
+	return remodule_dirmon_root.watcher != NULL;
+}
+
+static void
+remodule_dirmon_stop_watcher(void) {
+	PostQueuedCompletionStatus(remodule_dirmon_root.iocp, 0, 0, NULL);
+	WaitForSingleObject(remodule_dirmon_root.watcher, INFINITE);
+	CloseHandle(remodule_dirmon_root.watcher);
 }
 
 #else
 #error Unsupported platform
 #endif
 
-remodule_monitor_t*
-remodule_monitor(remodule_t* mod) {
-	const char* path = remodule_path(mod);
+static remodule_monitor_t*
+remodule_monitor_create(remodule_t* mod, const char* path, const remodule_monitor_options_t* options) {
 #ifdef __linux__
 	int len = (int)strlen(path);
 	int i;
@@ -445,6 +1348,7 @@ remodule_monitor(remodule_t* mod) {
 	++i;
 	int extra_size = len - i + 1;
 	const char* filename = path + i;
+	int name_length = len - i;
 #else
 	wchar_t wpath[MAX_PATH + 1];
 	int len = MultiByteToWideChar(
@@ -463,29 +1367,67 @@ remodule_monitor(remodule_t* mod) {
 	++i;
 	int extra_size = len - i + 1;
 	const wchar_t* filename = wpath + i;
+	int name_length = (int)wcslen(filename);
 #endif
 
 	remodule_monitor_t* mon = malloc(sizeof(remodule_monitor_t) + extra_size * sizeof(filename[0]));
+	remodule_monitor_lock(&remodule_dirmon_root.mutex);
 	remodule_dirmon_t* dirmon = remodule_dirmon_acquire(path);
 	*mon = (remodule_monitor_t){
+		.name_hash = remodule_monitor_hash(filename, name_length * sizeof(filename[0])),
+		.name_length = name_length,
 		.root_version = remodule_dirmon_root.version,
 		.dirmon = dirmon,
 		.mod = mod,
+		.settle_ms = options != NULL && options->settle_ms > 0 ? options->settle_ms : 0,
 	};
+	remodule_monitor_atomic_store(&mon->latest_version, 0);
+	remodule_monitor_atomic_store(&mon->queue_state, REMODULE_MONITOR_IDLE);
 	memcpy(mon->name, filename, extra_size * sizeof(filename[0]));
-	mon->link.next = &dirmon->monitors;
-	mon->link.prev = dirmon->monitors.prev;
-	dirmon->monitors.prev->next = &mon->link;
-	dirmon->monitors.prev = &mon->link;
+	remodule_dirmon_add_monitor(dirmon, mon);
+
+	if (dirmon->polled || (options != NULL && options->poll)) {
+		// A file being written must be seen unchanged by one more poll
+		if (mon->settle_ms < REMODULE_MONITOR_POLL_MIN_MS) {
+			mon->settle_ms = REMODULE_MONITOR_POLL_MIN_MS;
+		}
+		mon->file_info = remodule_monitor_file_info(mon);
+
+		mon->polled.next = &remodule_dirmon_root.polled;
+		mon->polled.prev = remodule_dirmon_root.polled.prev;
+		remodule_dirmon_root.polled.prev->next = &mon->polled;
+		remodule_dirmon_root.polled.prev = &mon->polled;
+	}
+	remodule_monitor_unlock(&remodule_dirmon_root.mutex);
 
 	return mon;
 }
 
+remodule_monitor_t*
+remodule_monitor(remodule_t* mod) {
+	return remodule_monitor_create(mod, remodule_path(mod), NULL);
+}
+
+remodule_monitor_t*
+remodule_monitor_ex(remodule_t* mod, const remodule_monitor_options_t* options) {
+	return remodule_monitor_create(mod, remodule_path(mod), options);
+}
+
+const remodule_monitor_stats_t*
+remodule_monitor_stats(remodule_monitor_t* mon) {
+	remodule_monitor_lock(&remodule_dirmon_root.mutex);
+	mon->stats_copy = mon->stats;
+	remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+
+	mon->stats_copy.num_suppressed_events += mon->num_coalesced_changes;
+	mon->stats_copy.num_changes = mon->num_changes;
+	return &mon->stats_copy;
+}
+
 bool
 remodule_check(remodule_monitor_t* mon) {
 	if (remodule_should_reload(mon)) {
-		remodule_reload(mon->mod);
-		return true;
+		return remodule_reload(mon->mod);
 	} else {
 		return false;
 	}
@@ -493,25 +1435,214 @@ remodule_check(remodule_monitor_t* mon) {
 
 bool
 remodule_should_reload(remodule_monitor_t* mon) {
-	if (mon->root_version == remodule_dirmon_root.version) {
-		remodule_dirmon_update_all();
+	// The watcher thread does the file system work
+	if (!remodule_monitor_atomic_load(&remodule_dirmon_root.watching)) {
+		remodule_monitor_lock(&remodule_dirmon_root.mutex);
+		if (mon->root_version == remodule_dirmon_root.version) {
+			remodule_dirmon_update_all();
+		}
+		mon->root_version = remodule_dirmon_root.version;
+		remodule_monitor_unlock(&remodule_dirmon_root.mutex);
 	}
-	mon->root_version = remodule_dirmon_root.version;
 
-	if (mon->loaded_version == mon->latest_version) {
+	int latest_version = remodule_monitor_atomic_load(&mon->latest_version);
+	if (mon->loaded_version == latest_version) {
 		return false;
 	} else {
-		mon->loaded_version = mon->latest_version;
+		// Changes that settled between two checks only cause one reload
+		mon->num_coalesced_changes += latest_version - mon->loaded_version - 1;
+		++mon->num_changes;
+		mon->loaded_version = latest_version;
 		return true;
 	}
 }
 
 void
 remodule_unmonitor(remodule_monitor_t* mon) {
-	mon->link.prev->next = mon->link.next;
-	mon->link.next->prev = mon->link.prev;
+	remodule_monitor_lock(&remodule_dirmon_root.mutex);
+	if (mon->pending.next != NULL) { remodule_monitor_unlink_pending(mon); }
+	if (mon->polled.next != NULL) {
+		mon->polled.next->prev = mon->polled.prev;
+		mon->polled.prev->next = mon->polled.next;
+	}
+	remodule_dirmon_remove_monitor(mon->dirmon, mon);
 	remodule_dirmon_release(mon->dirmon);
-	free(mon);
+	remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+
+	// Otherwise, the consumer frees it when it gets to it
+	if (
+		remodule_monitor_atomic_exchange(&mon->queue_state, REMODULE_MONITOR_REMOVED)
+		!= REMODULE_MONITOR_QUEUED
+	) {
+		free(mon);
+	}
+}
+
+remodule_monitor_handle_t
+remodule_monitor_handle(void) {
+	remodule_monitor_lock(&remodule_dirmon_root.mutex);
+#if defined(__linux__)
+	remodule_monitor_handle_t handle = remodule_dirmon_root.inotifyfd;
+#elif defined(_WIN32)
+	remodule_monitor_handle_t handle = remodule_dirmon_root.iocp;
+#endif
+	remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+	return handle;
+}
+
+bool
+remodule_monitor_wait(int timeout_ms) {
+	REMODULE_ASSERT(
+		!remodule_monitor_atomic_load(&remodule_dirmon_root.watching),
+		"The watcher thread is running"
+	);
+
+	uint64_t start_ms = remodule_monitor_now_ms();
+	remodule_monitor_lock(&remodule_dirmon_root.mutex);
+	while (remodule_dirmon_root.num_dirmons > 0) {
+		if (remodule_dirmon_update_all()) {
+			remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+			return true;
+		}
+
+		int wait_ms = remodule_dirmon_settle_timeout();
+		if (timeout_ms >= 0) {
+			uint64_t elapsed_ms = remodule_monitor_now_ms() - start_ms;
+			if (elapsed_ms >= (uint64_t)timeout_ms) { break; }
+
+			int remaining_ms = timeout_ms - (int)elapsed_ms;
+			if (wait_ms < 0 || wait_ms > remaining_ms) { wait_ms = remaining_ms; }
+		}
+
+		remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+		remodule_dirmon_poll(wait_ms);
+		remodule_monitor_lock(&remodule_dirmon_root.mutex);
+	}
+
+	remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+	return false;
+}
+
+int
+remodule_monitor_settle_timeout(void) {
+	remodule_monitor_lock(&remodule_dirmon_root.mutex);
+	int timeout_ms = remodule_dirmon_settle_timeout();
+	remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+	return timeout_ms;
+}
+
+static int
+remodule_dirmon_settle_timeout(void) {
+	uint64_t now_ms = remodule_monitor_now_ms();
+	int timeout_ms = -1;
+
+	for (
+		remodule_monitor_link_t* itr = remodule_dirmon_root.pending.next;
+		itr != &remodule_dirmon_root.pending;
+		itr = itr->next
+	) {
+		remodule_monitor_t* mon = (remodule_monitor_t*)((char*)itr - offsetof(remodule_monitor_t, pending));
+		uint64_t elapsed_ms = now_ms - mon->last_event_ms;
+		int remaining_ms = elapsed_ms >= (uint64_t)mon->settle_ms ? 0 : mon->settle_ms - (int)elapsed_ms;
+		if (timeout_ms < 0 || remaining_ms < timeout_ms) { timeout_ms = remaining_ms; }
+	}
+
+	if (remodule_dirmon_root.polled.next != &remodule_dirmon_root.polled) {
+		uint64_t next_poll_ms = remodule_dirmon_root.next_poll_ms;
+		int remaining_ms = now_ms >= next_poll_ms ? 0 : (int)(next_poll_ms - now_ms);
+		if (timeout_ms < 0 || remaining_ms < timeout_ms) { timeout_ms = remaining_ms; }
+	}
+
+	return timeout_ms;
+}
+
+static void
+remodule_dirmon_watch(void) {
+	remodule_monitor_lock(&remodule_dirmon_root.mutex);
+	while (!remodule_dirmon_root.stop_watcher) {
+		remodule_dirmon_update_all();
+		int wait_ms = remodule_dirmon_settle_timeout();
+
+		remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+		remodule_dirmon_poll(wait_ms);
+		remodule_monitor_lock(&remodule_dirmon_root.mutex);
+	}
+	remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+}
+
+bool
+remodule_monitor_start_thread(void) {
+	remodule_monitor_lock(&remodule_dirmon_root.mutex);
+	if (remodule_monitor_atomic_load(&remodule_dirmon_root.watching)) {
+		remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+		return false;
+	}
+
+	// Kept open for the lifetime of the thread
+	remodule_dirmon_open();
+	remodule_dirmon_root.stop_watcher = false;
+	remodule_monitor_atomic_store(&remodule_dirmon_root.watching, 1);
+	bool started = remodule_dirmon_start_watcher();
+	if (!started) {
+		remodule_monitor_atomic_store(&remodule_dirmon_root.watching, 0);
+		remodule_dirmon_close();
+	}
+	remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+
+	return started;
+}
+
+void
+remodule_monitor_stop_thread(void) {
+	remodule_monitor_lock(&remodule_dirmon_root.mutex);
+	if (!remodule_monitor_atomic_load(&remodule_dirmon_root.watching)) {
+		remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+		return;
+	}
+	remodule_dirmon_root.stop_watcher = true;
+	remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+
+	remodule_dirmon_stop_watcher();
+
+	remodule_monitor_lock(&remodule_dirmon_root.mutex);
+	remodule_monitor_atomic_store(&remodule_dirmon_root.watching, 0);
+	remodule_dirmon_close();
+	remodule_monitor_unlock(&remodule_dirmon_root.mutex);
+}
+
+remodule_monitor_t*
+remodule_monitor_next_change(void) {
+	while (true) {
+		if (remodule_dirmon_root.taken_changes == NULL) {
+			remodule_monitor_t* batch = remodule_monitor_atomic_ptr_exchange(&remodule_dirmon_root.changes, NULL);
+			if (batch == NULL) { return NULL; }
+
+			// Reverse it so that changes come out in order
+			while (batch != NULL) {
+				remodule_monitor_t* next = batch->next_change;
+				batch->next_change = remodule_dirmon_root.taken_changes;
+				remodule_dirmon_root.taken_changes = batch;
+				batch = next;
+			}
+		}
+
+		remodule_monitor_t* mon = remodule_dirmon_root.taken_changes;
+		remodule_dirmon_root.taken_changes = mon->next_change;
+		if (
+			remodule_monitor_atomic_exchange(&mon->queue_state, REMODULE_MONITOR_IDLE)
+			== REMODULE_MONITOR_REMOVED
+		) {
+			free(mon);
+			continue;
+		}
+
+		return mon;
+	}
+}
+
+remodule_t*
+remodule_monitor_module(remodule_monitor_t* mon) {
+	return mon->mod;
 }
 
 #endif